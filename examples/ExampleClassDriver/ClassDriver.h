@@ -50,7 +50,7 @@ public:
 	}
 
 	// Must check with CanSend() right before this call.
-	void SendPacket(const uint8_t packetSize)
+	void SendPacket(const PacketSizeType packetSize)
 	{
 		// Blank reader to ignore cross-talk.
 		Reader.BlankReceive();
@@ -72,7 +72,7 @@ public:
 		{
 			PacketReceivedFlag = false;
 
-			uint8_t incomingSize = 0;
+			PacketSizeType incomingSize = 0;
 
 			if (Reader.HasIncoming(incomingSize))
 			{
@@ -84,7 +84,7 @@ public:
 				Serial.print(incomingSize);
 				Serial.println(F(") bytes"));
 
-				for (uint8_t i = 0; i < incomingSize; i++)
+				for (PacketSizeType i = 0; i < incomingSize; i++)
 				{
 					Serial.print((char)IncomingPacket[i]);
 				}
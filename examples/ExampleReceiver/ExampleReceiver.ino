@@ -49,7 +49,7 @@ void loop()
 
 		Serial.print(F("OnPacketReceived @"));
 
-		uint8_t incomingSize = 0;
+		PacketSizeType incomingSize = 0;
 		if (Reader.HasIncoming(incomingSize))
 		{
 			// When packet is available.
@@ -60,7 +60,7 @@ void loop()
 			Serial.print(incomingSize);
 			Serial.println(F(") bytes"));
 
-			for (uint8_t i = 0; i < incomingSize; i++)
+			for (PacketSizeType i = 0; i < incomingSize; i++)
 			{
 				Serial.print((char)IncomingBuffer[i]);
 			}
@@ -0,0 +1,48 @@
+//
+// Example of a cut-through Repeater, extending a link by one hop.
+// Packets coming in on ReadPin are re-emitted on WritePin while still being received.
+//
+
+#define DEBUG_LOG
+
+#include <PulseIntervalModulator.h>
+
+const uint8_t ReadPin = 2;
+const uint8_t WritePin = 7;
+const uint8_t BufferSize = 32;
+
+PacketRepeater<BufferSize> Repeater(ReadPin, WritePin);
+
+const uint32_t LogPeriodMillis = 1000;
+uint32_t LastLog = 0;
+
+void setup()
+{
+#ifdef DEBUG_LOG
+	Serial.begin(115200);
+#endif
+
+	Repeater.Start();
+
+#ifdef DEBUG_LOG
+	Serial.println(F("ExampleRepeater Start."));
+#endif
+}
+
+void loop()
+{
+#if defined(PIM_SILENCE_TIMEOUT)
+	Repeater.CheckTimeout();
+#endif
+
+#ifdef DEBUG_LOG
+	if (millis() - LastLog > LogPeriodMillis)
+	{
+		LastLog = millis();
+		Serial.print(F("Forwarded: "));
+		Serial.print(Repeater.GetForwardedCount());
+		Serial.print(F(" Aborted: "));
+		Serial.println(Repeater.GetAbortedCount());
+	}
+#endif
+}
\ No newline at end of file
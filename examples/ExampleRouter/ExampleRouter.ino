@@ -0,0 +1,143 @@
+//
+// Example of a Task Driver with message type routing.
+// The first byte of each packet is the message type, the route table picks the handler.
+// Is based on OOP Class for Task Scheduler (https://github.com/arkhipenko/TaskScheduler).
+//
+
+#define DEBUG_LOG
+
+#define _TASK_OO_CALLBACKS
+#include <TaskScheduler.h>
+
+#include <PulsePacketTaskDriver.h>
+
+// Process scheduler.
+Scheduler SchedulerBase;
+
+const uint8_t MaxPacketSize = 32;
+const uint8_t ReadPin = 2;
+const uint8_t WritePin = 7;
+
+class RouterDriver : public PulsePacketTaskDriver<MaxPacketSize>
+{
+public:
+	enum MessageType : uint8_t
+	{
+		Ping,
+		Sample,
+		Text
+	};
+
+public:
+	RouterDriver(Scheduler* scheduler, const uint8_t readPin, const uint8_t writePin)
+		: PulsePacketTaskDriver<MaxPacketSize>(scheduler, readPin, writePin)
+	{}
+
+	static void OnPing(RouterDriver& driver, const uint32_t startTimestamp, const uint8_t* payload, const PacketSizeType payloadSize)
+	{
+#ifdef DEBUG_LOG
+		Serial.print(F("Ping @"));
+		Serial.print(startTimestamp);
+		Serial.println(F(" us"));
+#endif
+	}
+
+	static void OnSample(RouterDriver& driver, const uint32_t startTimestamp, const uint8_t* payload, const PacketSizeType payloadSize)
+	{
+#ifdef DEBUG_LOG
+		Serial.print(F("Sample: "));
+		Serial.println(((uint16_t)payload[0] << 8) | payload[1]);
+#endif
+	}
+
+	static void OnText(RouterDriver& driver, const uint32_t startTimestamp, const uint8_t* payload, const PacketSizeType payloadSize)
+	{
+#ifdef DEBUG_LOG
+		Serial.print(F("Text: "));
+		for (PacketSizeType i = 0; i < payloadSize; i++)
+		{
+			Serial.print((char)payload[i]);
+		}
+		Serial.println();
+#endif
+	}
+
+protected:
+	void OnDriverPacketReceived(const uint32_t startTimestamp, const PacketSizeType packetSize);
+};
+
+typedef PulsePacketRouter<RouterDriver> RouterType;
+
+// Indexed by MessageType, kept in flash.
+constexpr RouterType::Route Routes[] PROGMEM = {
+	{ RouterDriver::OnPing, 0 },
+	{ RouterDriver::OnSample, 2 },
+	{ RouterDriver::OnText, RouterType::AnyPayloadSize }
+};
+
+RouterType Router(Routes);
+
+RouterDriver Driver(&SchedulerBase, ReadPin, WritePin);
+
+void RouterDriver::OnDriverPacketReceived(const uint32_t startTimestamp, const PacketSizeType packetSize)
+{
+	Router.Dispatch(*this, startTimestamp, IncomingPacket, packetSize);
+}
+
+class SenderTask : public Task
+{
+private:
+	static const uint32_t SendPeriodMillis = 500;
+
+	uint8_t Message[3] = { RouterDriver::Sample, 0, 0 };
+
+public:
+	SenderTask(Scheduler* scheduler)
+		: Task(SendPeriodMillis, TASK_FOREVER, scheduler, false)
+	{
+	}
+
+	bool Callback()
+	{
+		if (Driver.CanSend())
+		{
+			const uint16_t sample = analogRead(A0);
+			Message[1] = sample >> 8;
+			Message[2] = sample;
+			Driver.SendPacket(Message, sizeof(Message));
+		}
+
+		return true;
+	}
+} SenderTask(&SchedulerBase);
+
+
+void setup()
+{
+#ifdef DEBUG_LOG
+	Serial.begin(115200);
+#endif
+
+	Driver.Start();
+
+	SenderTask.enable();
+
+#ifdef DEBUG_LOG
+	Serial.println(F("ExampleRouter Start."));
+#endif
+}
+
+void loop()
+{
+	SchedulerBase.execute();
+
+#ifdef DEBUG_LOG
+	static uint16_t LastUnrouted = 0;
+	if (Router.GetUnroutedCount() != LastUnrouted)
+	{
+		LastUnrouted = Router.GetUnroutedCount();
+		Serial.print(F("Unrouted: "));
+		Serial.println(LastUnrouted);
+	}
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+//
+// Example of streamed packets, with neither a send nor a receive buffer.
+// The writer asks for each byte while the previous one goes out,
+// the reader hands each byte over as soon as it's complete.
+// Sends a counting pattern of MaxDataBytes and checks it on receive, wire the pins together.
+//
+
+#define DEBUG_LOG
+
+//#define PIM_STREAMING must be enabled in Constants.
+#include <PulseIntervalModulator.h>
+
+const uint8_t ReadPin = 2;
+const uint8_t WritePin = 7;
+
+const PacketSizeType PacketSize = Constants::MaxDataBytes;
+
+const uint32_t SendPeriodMillis = 500;
+
+class StreamWriterHandler : public PacketWriterHandler
+{
+public:
+	volatile bool Sent = false;
+
+	void OnPacketSent()
+	{
+		Sent = true;
+	}
+
+	const uint8_t GetStreamByte(const PacketSizeType byteIndex)
+	{
+		return (uint8_t)byteIndex;
+	}
+};
+
+class StreamReaderHandler : public PacketReaderHandler
+{
+public:
+	volatile PacketSizeType Errors = 0;
+	volatile bool Received = false;
+	volatile bool Lost = false;
+
+	void OnStreamByte(const PacketSizeType byteIndex, const uint8_t value)
+	{
+		if (value != (uint8_t)byteIndex)
+		{
+			Errors++;
+		}
+	}
+
+	void OnPacketReceived(const uint32_t startTimestamp)
+	{
+		Received = true;
+	}
+
+	void OnPacketLost(const uint32_t startTimestamp)
+	{
+		Lost = true;
+	}
+};
+
+TemplatePacketReader<StreamReaderHandler> Reader(StreamReaderHandler(), nullptr, PacketSize, ReadPin);
+TemplatePacketWriter<StreamWriterHandler> Writer(StreamWriterHandler(), PacketSize, WritePin);
+
+uint32_t LastSent = 0;
+
+void setup()
+{
+#ifdef DEBUG_LOG
+	Serial.begin(115200);
+#endif
+
+	Reader.Start();
+	Writer.Start();
+
+#ifdef DEBUG_LOG
+	Serial.println(F("ExampleStreaming Start."));
+#endif
+}
+
+void loop()
+{
+	StreamReaderHandler& receiver = Reader.GetHandler();
+
+	if (receiver.Received)
+	{
+		receiver.Received = false;
+
+#ifdef DEBUG_LOG
+		Serial.print(F("Received "));
+		Serial.print(PacketSize);
+		Serial.print(F(" bytes, "));
+		Serial.print(receiver.Errors);
+		Serial.println(F(" wrong."));
+#endif
+		receiver.Errors = 0;
+
+		// Ready for the next packet.
+		Reader.Restore();
+	}
+
+	if (receiver.Lost)
+	{
+		receiver.Lost = false;
+		receiver.Errors = 0;
+
+#ifdef DEBUG_LOG
+		Serial.println(F("Lost packet, bytes so far discarded."));
+#endif
+	}
+
+	if (millis() - LastSent > SendPeriodMillis)
+	{
+		LastSent = millis();
+		Writer.SendStream(PacketSize);
+	}
+}
\ No newline at end of file
@@ -1,5 +1,5 @@
 //
-// Example of Task Driver, using the interface callbacks.
+// Example of Task Driver, using compile time callbacks.
 // Reads and Writes in Half-Duplex mode, avoiding collisions.
 // Is based on OOP Class for Task Scheduler (https://github.com/arkhipenko/TaskScheduler).
 //
@@ -9,7 +9,7 @@
 #define _TASK_OO_CALLBACKS
 #include <TaskScheduler.h>
 
-// #define PIM_USE_STATIC_CALLBACK must be disabled in Constants.
+// Independent of PIM_USE_STATIC_CALLBACK.
 #include <PulsePacketTaskDriver.h>
 
 // Process scheduler.
@@ -0,0 +1,142 @@
+//
+// Example of network time with PulseTimeSync.
+// The master sends a beacon every second, the other nodes follow its clock
+// and blink their LED on each network second, all in step.
+// Needs PIM_TIME_SYNC on the master, for the beacon send timestamps.
+// Is based on OOP Class for Task Scheduler (https://github.com/arkhipenko/TaskScheduler).
+//
+
+#define DEBUG_LOG
+
+// Comment out on the other nodes.
+#define TIME_MASTER
+
+#define _TASK_OO_CALLBACKS
+#include <TaskScheduler.h>
+
+#include <PulsePacketTaskDriver.h>
+
+// Process scheduler.
+Scheduler SchedulerBase;
+
+const uint8_t MaxPacketSize = 32;
+const uint8_t ReadPin = 2;
+const uint8_t WritePin = 7;
+
+const uint8_t BeaconType = 0xB5;
+
+PulseTimeSync<> TimeSync;
+
+class TimeSyncDriver : public PulsePacketTaskDriver<MaxPacketSize>
+{
+private:
+	uint8_t Beacon[1 + PulseTimeSync<>::BeaconSize] = { BeaconType };
+
+	bool BeaconPending = false;
+
+public:
+	TimeSyncDriver(Scheduler* scheduler, const uint8_t readPin, const uint8_t writePin)
+		: PulsePacketTaskDriver<MaxPacketSize>(scheduler, readPin, writePin)
+	{}
+
+	void SendBeacon()
+	{
+		if (!BeaconPending && CanSend())
+		{
+			TimeSync.WriteBeacon(&Beacon[1]);
+			BeaconPending = true;
+			SendPacket(Beacon, sizeof(Beacon));
+		}
+	}
+
+protected:
+	void OnDriverPacketSent()
+	{
+#if defined(PIM_TIME_SYNC)
+		if (BeaconPending)
+		{
+			TimeSync.OnBeaconSent(GetLastSendTimestamp());
+		}
+#endif
+		BeaconPending = false;
+	}
+
+	void OnDriverPacketReceived(const uint32_t startTimestamp, const PacketSizeType packetSize)
+	{
+		if (packetSize == sizeof(Beacon)
+			&& IncomingPacket[0] == BeaconType)
+		{
+			TimeSync.OnBeaconReceived(&IncomingPacket[1], startTimestamp);
+		}
+	}
+} Driver(&SchedulerBase, ReadPin, WritePin);
+
+class BlinkTask : public Task
+{
+private:
+	static const uint32_t NetworkPeriodMicros = 1000000;
+
+	uint32_t NextBlink = 0;
+
+public:
+	BlinkTask(Scheduler* scheduler)
+		: Task(0, TASK_FOREVER, scheduler, false)
+	{
+	}
+
+	bool Callback()
+	{
+#if defined(TIME_MASTER)
+		const uint32_t now = micros();
+#else
+		if (!TimeSync.IsSynced())
+		{
+			return false;
+		}
+		const uint32_t now = TimeSync.GetNetworkMicros();
+#endif
+		if ((int32_t)(now - NextBlink) >= 0)
+		{
+			digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
+			NextBlink = ((now / NetworkPeriodMicros) + 1) * NetworkPeriodMicros;
+#if defined(TIME_MASTER)
+			Driver.SendBeacon();
+#endif
+		}
+
+		return true;
+	}
+} BlinkTask(&SchedulerBase);
+
+
+void setup()
+{
+#ifdef DEBUG_LOG
+	Serial.begin(115200);
+#endif
+
+	pinMode(LED_BUILTIN, OUTPUT);
+
+	Driver.Start();
+
+	BlinkTask.enable();
+
+#ifdef DEBUG_LOG
+	Serial.println(F("ExampleTimeSync Start."));
+#endif
+}
+
+void loop()
+{
+	SchedulerBase.execute();
+
+#if defined(DEBUG_LOG) && !defined(TIME_MASTER)
+	static uint32_t LastReport = 0;
+	if (TimeSync.IsSynced() && millis() - LastReport > 5000)
+	{
+		LastReport = millis();
+		Serial.print(F("Drift (1/2^24): "));
+		Serial.println(TimeSync.GetDrift());
+	}
+#endif
+}
\ No newline at end of file
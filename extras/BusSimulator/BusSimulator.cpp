@@ -0,0 +1,822 @@
+// BusSimulator.cpp
+// Capacity planning for large deployments: many independent shared lines, each with many nodes
+// queueing packets through the driver's carrier sense and send scheduler.
+// Sweeps nodes per line and packet rate and prints one CSV row per point:
+// throughput, collision rate, drops and queueing latency percentiles.
+// Then prints the wall time of the same sweep for each thread count, as # lines.
+//
+// Each line is a discrete event simulation of whole packets, not pulses.
+// Nodes mirror PulsePacketTaskDriver::ServiceSendQueue(): the same PulseSendQueue,
+// backoff random generator, CanSend() silence intervals, retry and drop rules.
+// Airtime is the writer's pulse sequence for the actual payload bits.
+// A transmission is seen by the other nodes after --latency, so nodes that start within it collide.
+// Both senders see the collision one bit later and back off, a sender that finishes first
+// counts the packet as sent but it's corrupted.
+// The driver loop is polled on arrivals, backoff ends and send completions, each pass late by up to --loop.
+//
+// Lines are independent and spread over the worker threads, each line has its own random
+// generator seeded from --seed and its index, so results don't depend on the thread count.
+//
+// Queue, backoff and timing options are compile time, as for the firmware:
+// g++ -O2 -std=c++11 -pthread -I src extras/BusSimulator/BusSimulator.cpp -o BusSimulator
+// Add -DPIM_SEND_QUEUE_SIZE=8 or -DPIM_CSMA_MAX_BACKOFF_EXPONENT=8 to compare settings.
+//
+// Usage:
+// BusSimulator [options]
+//	--buses <n>			Lines per point, default 32.
+//	--nodes <a,b,..>	Nodes per line, default 8,16,32.
+//	--rate <a,b,..>		Packets per second per node, default 1,5,20.
+//	--size <n>			Bulk payload size, default 16.
+//	--urgent <p>		Share of urgent packets, in class 0 with a deadline, default 0.1.
+//	--urgent-size <n>	Urgent payload size, default 4.
+//	--deadline <us>		Urgent packet deadline, default 20000.
+//	--seconds <n>		Simulated time per line, default 10.
+//	--loop <us>			Driver loop pass time, default 50.
+//	--latency <us>		Carrier sense latency, default 8.
+//	--threads <a,b,..>	Thread counts to time, default 1,2,4,8.
+//	--seed <n>			Random seed, default 1.
+//	--no-header			Don't print the CSV header.
+
+#define PIM_CSMA
+#define PIM_SEND_SCHEDULER
+
+#include <PulsePacket/PulseSendQueue.h>
+#include <PulseIntervalModulator/HammingCode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+static const PacketSizeType SimMaxPacketSize = Constants::MaxDataBytes;
+static const uint8_t UrgentClass = 0;
+static const uint8_t BulkClass = Constants::SendPriorityClasses - 1;
+
+struct SimConfig
+{
+	uint32_t Buses;
+	PacketSizeType BulkSize;
+	PacketSizeType UrgentSize;
+	double UrgentShare;
+	uint32_t Deadline;
+	uint64_t DurationMicros;
+	uint32_t LoopMicros;
+	uint32_t LatencyMicros;
+	uint64_t Seed;
+};
+
+struct SimPoint
+{
+	uint16_t Nodes;
+	double Rate;
+};
+
+struct BusResult
+{
+	uint64_t Events = 0;
+	uint64_t Offered = 0;
+	uint64_t Rejected = 0; // Queue full.
+	uint64_t Attempts = 0;
+	uint64_t Delivered = 0;
+	uint64_t DeliveredBytes = 0;
+	uint64_t Corrupted = 0; // Sent without seeing the collision.
+	uint64_t Overlapped = 0;
+	uint64_t Collisions = 0;
+	uint64_t Deferrals = 0;
+	uint64_t Dropped = 0;
+	uint64_t Expired = 0;
+	uint64_t AirtimeMicros = 0;
+	std::vector<uint32_t> Latencies;
+	std::vector<uint32_t> UrgentLatencies;
+
+	const bool operator==(const BusResult& other) const
+	{
+		return Events == other.Events
+			&& Offered == other.Offered
+			&& Rejected == other.Rejected
+			&& Attempts == other.Attempts
+			&& Delivered == other.Delivered
+			&& DeliveredBytes == other.DeliveredBytes
+			&& Corrupted == other.Corrupted
+			&& Overlapped == other.Overlapped
+			&& Collisions == other.Collisions
+			&& Deferrals == other.Deferrals
+			&& Dropped == other.Dropped
+			&& Expired == other.Expired
+			&& AirtimeMicros == other.AirtimeMicros
+			&& Latencies == other.Latencies
+			&& UrgentLatencies == other.UrgentLatencies;
+	}
+};
+
+// Same pulse sequence as TemplatePacketWriter, data at the base rate.
+static const uint32_t GetAirtime(const uint8_t* data, const PacketSizeType size)
+{
+	uint32_t airtime = Constants::PreambleInterval;
+	uint32_t headerValue = 0;
+
+#if defined(PIM_EXTENDED_HEADER)
+	if (size >= Constants::ExtendedBaseBytes)
+	{
+		headerValue = Constants::HeaderEscape;
+
+		// 8 bits per 7 bit size group.
+		PacketSizeType extendedSize = size - Constants::ExtendedBaseBytes;
+		uint8_t groups = 1;
+		while ((extendedSize >> (Constants::ExtendedGroupBits * groups)) > 0)
+		{
+			groups++;
+		}
+		for (uint8_t i = 0; i < groups; i++)
+		{
+			const uint8_t group = (extendedSize & 0x7F) | ((i > 0) ? 0x80 : 0);
+			extendedSize >>= Constants::ExtendedGroupBits;
+			for (uint8_t bit = 0; bit < 8; bit++)
+			{
+				airtime += ((group >> bit) & 0x01) ? Constants::OneInterval : Constants::ZeroInterval;
+			}
+		}
+	}
+	else
+#endif
+	{
+		headerValue = size - Constants::MinDataBytes;
+	}
+#if defined(PIM_RATE_SWITCHING)
+	headerValue <<= Constants::RateBits;
+#endif
+
+	for (uint8_t bit = 0; bit < Constants::HeaderFieldBits; bit++)
+	{
+		airtime += ((headerValue >> bit) & 0x01) ? Constants::OneInterval : Constants::ZeroInterval;
+	}
+
+	for (PacketSizeType i = 0; i < size; i++)
+	{
+#if defined(PIM_FEC)
+		const uint16_t word = HammingCode::Encode(data[i]);
+#else
+		const uint16_t word = data[i];
+#endif
+		for (uint8_t bit = 0; bit < Constants::DataWordBits; bit++)
+		{
+			airtime += ((word >> bit) & 0x01) ? Constants::OneInterval : Constants::ZeroInterval;
+		}
+	}
+
+	return airtime;
+}
+
+class SimBus
+{
+private:
+	enum class EventType : uint8_t
+	{
+		Arrival,
+		Poll,
+		SendDone,
+		Collision
+	};
+
+	struct SimEvent
+	{
+		uint64_t Time;
+		uint64_t Sequence;
+		uint32_t Token;
+		uint16_t Node;
+		EventType Type;
+
+		const bool operator>(const SimEvent& other) const
+		{
+			return (Time != other.Time) ? Time > other.Time : Sequence > other.Sequence;
+		}
+	};
+
+	struct Transmission
+	{
+		uint64_t Start;
+		uint64_t End;
+		uint32_t Serial;
+		uint16_t Node;
+		bool Overlapped;
+	};
+
+	// Driver state, as in PulsePacketTaskDriver with PIM_CSMA and PIM_SEND_SCHEDULER.
+	struct SimNode
+	{
+		PulseSendQueue<SimMaxPacketSize, Constants::SendQueueSize> Queue;
+		uint32_t RandomState = 1;
+		uint32_t BackoffStart = 0;
+		uint32_t BackoffInterval = 0;
+		uint32_t SendStart = 0;
+		uint8_t BackoffExponent = 0;
+		uint8_t SendAttempts = 0;
+		bool HeadScheduled = false;
+		bool LineBusy = false;
+		bool Sending = false;
+
+		// Never sent yet, so its silence has passed.
+		int64_t LastPulse = INT32_MIN;
+
+		// Pending poll, stale poll events don't match the token.
+		uint64_t NextPoll = UINT64_MAX;
+		uint32_t PollToken = 0;
+
+		uint32_t Serial = 0;
+	};
+
+	const SimConfig& Config;
+	const SimPoint Point;
+	BusResult& Result;
+
+	std::mt19937_64 Random;
+	std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> Events;
+	std::vector<SimNode> Nodes;
+	std::vector<Transmission> Line;
+	uint64_t Now = 0;
+	uint64_t NextSequence = 0;
+	uint32_t NextSerial = 0;
+
+	uint8_t Payload[SimMaxPacketSize];
+
+public:
+	SimBus(const SimConfig& config, const SimPoint& point, const uint32_t pointIndex, const uint32_t busIndex, BusResult& result)
+		: Config(config)
+		, Point(point)
+		, Result(result)
+		, Nodes(point.Nodes)
+	{
+		std::seed_seq seeds = { (uint32_t)config.Seed, (uint32_t)(config.Seed >> 32), pointIndex, busIndex };
+		Random.seed(seeds);
+
+		for (uint16_t i = 0; i < Nodes.size(); i++)
+		{
+			// Unique seeds, as SetRandomSeed() with the node address.
+			Nodes[i].RandomState = (uint32_t)Random() | 1;
+			Push(NextArrival(), i, EventType::Arrival, 0);
+		}
+	}
+
+	void Run()
+	{
+		while (!Events.empty()
+			&& Events.top().Time < Config.DurationMicros)
+		{
+			const SimEvent event = Events.top();
+			Events.pop();
+			Now = event.Time;
+			Result.Events++;
+
+			SimNode& node = Nodes[event.Node];
+			switch (event.Type)
+			{
+			case EventType::Arrival:
+				OnArrival(event.Node);
+				Push(Now + NextArrival(), event.Node, EventType::Arrival, 0);
+				break;
+			case EventType::Poll:
+				if (event.Token == node.PollToken)
+				{
+					node.NextPoll = UINT64_MAX;
+					ServiceSendQueue(event.Node);
+				}
+				break;
+			case EventType::SendDone:
+				if (node.Sending && event.Token == node.Serial)
+				{
+					OnSendDone(event.Node);
+				}
+				break;
+			case EventType::Collision:
+				if (node.Sending && event.Token == node.Serial)
+				{
+					OnCollision(event.Node);
+				}
+				break;
+			}
+		}
+	}
+
+private:
+	void Push(const uint64_t time, const uint16_t node, const EventType type, const uint32_t token)
+	{
+		Events.push({ time, NextSequence++, token, node, type });
+	}
+
+	const uint64_t NextArrival()
+	{
+		const double u = std::uniform_real_distribution<double>(0, 1)(Random);
+
+		return 1 + (uint64_t)(-log(1 - u) * 1000000.0 / Point.Rate);
+	}
+
+	// Next driver loop pass.
+	void SchedulePoll(const uint16_t index, const uint64_t time)
+	{
+		SimNode& node = Nodes[index];
+		const uint64_t pass = std::max(time, Now) + 1 + (Random() % Config.LoopMicros);
+		if (pass < node.NextPoll)
+		{
+			node.NextPoll = pass;
+			Push(pass, index, EventType::Poll, ++node.PollToken);
+		}
+	}
+
+	void OnArrival(const uint16_t index)
+	{
+		SimNode& node = Nodes[index];
+		const bool urgent = std::uniform_real_distribution<double>(0, 1)(Random) < Config.UrgentShare;
+		const PacketSizeType size = urgent ? Config.UrgentSize : Config.BulkSize;
+		for (PacketSizeType i = 0; i < size; i++)
+		{
+			Payload[i] = (uint8_t)Random();
+		}
+
+		Result.Offered++;
+		if (!node.Queue.Push(Payload, size, urgent ? UrgentClass : BulkClass, urgent ? Config.Deadline : 0, (uint32_t)Now))
+		{
+			Result.Rejected++;
+			return;
+		}
+
+		if (!node.Sending)
+		{
+			SchedulePoll(index, Now);
+		}
+	}
+
+	void ServiceSendQueue(const uint16_t index)
+	{
+		SimNode& node = Nodes[index];
+		const uint32_t now = (uint32_t)Now;
+
+		DropExpired(node);
+
+		if (node.Queue.IsEmpty()
+			|| node.Sending)
+		{
+			return;
+		}
+
+		if (!node.HeadScheduled)
+		{
+			node.HeadScheduled = true;
+			node.LineBusy = false;
+			node.SendAttempts = 0;
+			node.BackoffExponent = Constants::MinBackoffExponent;
+			node.Queue.Select();
+			ScheduleBackoff(node);
+		}
+
+		if (now - node.BackoffStart < node.BackoffInterval)
+		{
+			SchedulePoll(index, Now + (node.BackoffInterval - (now - node.BackoffStart)));
+			return;
+		}
+
+		if (CanSend(index))
+		{
+			if (node.LineBusy)
+			{
+				node.LineBusy = false;
+				WidenBackoff(node);
+				SchedulePoll(index, Now + node.BackoffInterval);
+				return;
+			}
+
+			if (node.Queue.Select())
+			{
+				node.SendAttempts = 0;
+			}
+			node.SendStart = now;
+			StartSending(index);
+		}
+		else
+		{
+			if (!node.LineBusy)
+			{
+				node.LineBusy = true;
+				Result.Deferrals++;
+			}
+			SchedulePoll(index, GetSilenceEnd(index));
+		}
+	}
+
+	void DropExpired(SimNode& node)
+	{
+		uint8_t priority = 0;
+		while (node.Queue.PopExpired((uint32_t)Now, node.Sending, priority))
+		{
+			Result.Expired++;
+			node.HeadScheduled = false;
+		}
+	}
+
+	void Backoff(SimNode& node)
+	{
+		node.SendAttempts++;
+		if (node.SendAttempts >= Constants::MaxSendAttempts)
+		{
+			node.Queue.Pop();
+			node.HeadScheduled = false;
+			Result.Dropped++;
+			return;
+		}
+
+		WidenBackoff(node);
+	}
+
+	void WidenBackoff(SimNode& node)
+	{
+		if (node.BackoffExponent < Constants::MaxBackoffExponent)
+		{
+			node.BackoffExponent++;
+		}
+		ScheduleBackoff(node);
+	}
+
+	void ScheduleBackoff(SimNode& node)
+	{
+		node.BackoffStart = (uint32_t)Now;
+
+		node.RandomState += node.BackoffStart;
+		if (node.RandomState == 0)
+		{
+			node.RandomState = 1;
+		}
+		node.RandomState ^= node.RandomState << 13;
+		node.RandomState ^= node.RandomState >> 17;
+		node.RandomState ^= node.RandomState << 5;
+
+		node.BackoffInterval = (node.RandomState & ((1UL << node.BackoffExponent) - 1)) * Constants::BackoffSlotInterval;
+	}
+
+	// A foreign pulse is seen from Start + latency, and pulses keep coming until End.
+	const bool CanSend(const uint16_t index)
+	{
+		const SimNode& node = Nodes[index];
+		if ((int64_t)Now - node.LastPulse <= (int64_t)Constants::SendSilenceInterval)
+		{
+			return false;
+		}
+
+		for (const Transmission& transmission : Line)
+		{
+			if (transmission.Node != index
+				&& Now >= transmission.Start + Config.LatencyMicros
+				&& Now <= transmission.End + Config.LatencyMicros + Constants::ReceiveSilenceInterval)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// First time CanSend() is true, unless another transmission shows up first.
+	const uint64_t GetSilenceEnd(const uint16_t index)
+	{
+		const SimNode& node = Nodes[index];
+		uint64_t end = (uint64_t)std::max<int64_t>(node.LastPulse + Constants::SendSilenceInterval + 1, (int64_t)Now);
+
+		for (const Transmission& transmission : Line)
+		{
+			if (transmission.Node != index
+				&& Now >= transmission.Start + Config.LatencyMicros)
+			{
+				end = std::max(end, transmission.End + Config.LatencyMicros + Constants::ReceiveSilenceInterval + 1);
+			}
+		}
+
+		return end;
+	}
+
+	void StartSending(const uint16_t index)
+	{
+		SimNode& node = Nodes[index];
+
+		// Heard transmissions are past their silence, forget them.
+		Line.erase(std::remove_if(Line.begin(), Line.end(), [this](const Transmission& transmission)
+			{
+				return transmission.End + Config.LatencyMicros + Constants::ReceiveSilenceInterval < Now;
+			}), Line.end());
+
+		const uint64_t airtime = GetAirtime(node.Queue.PeekData(), node.Queue.PeekSize());
+		Transmission started = { Now, Now + airtime, ++NextSerial, index, false };
+
+		// Overlaps only start within the latency, each sender sees the other one bit after it shows up.
+		for (Transmission& other : Line)
+		{
+			if (other.End > Now)
+			{
+				other.Overlapped = true;
+				started.Overlapped = true;
+
+				const uint64_t seen = std::max(Now, other.Start + Config.LatencyMicros) + Constants::OneInterval;
+				if (seen < started.End)
+				{
+					Push(seen, index, EventType::Collision, started.Serial);
+				}
+				const uint64_t otherSeen = Now + Config.LatencyMicros + Constants::OneInterval;
+				if (otherSeen < other.End)
+				{
+					Push(otherSeen, other.Node, EventType::Collision, other.Serial);
+				}
+			}
+		}
+
+		Line.push_back(started);
+		node.Sending = true;
+		node.Serial = started.Serial;
+		Result.Attempts++;
+		Push(started.End, index, EventType::SendDone, started.Serial);
+	}
+
+	Transmission& Finish(const uint16_t index)
+	{
+		SimNode& node = Nodes[index];
+		node.Sending = false;
+		node.LastPulse = (int64_t)Now;
+
+		Transmission* transmission = &Line.front();
+		for (Transmission& candidate : Line)
+		{
+			if (candidate.Serial == node.Serial)
+			{
+				transmission = &candidate;
+			}
+		}
+		transmission->End = Now;
+		Result.AirtimeMicros += transmission->End - transmission->Start;
+		if (transmission->Overlapped)
+		{
+			Result.Overlapped++;
+		}
+
+		return *transmission;
+	}
+
+	void OnSendDone(const uint16_t index)
+	{
+		SimNode& node = Nodes[index];
+		const Transmission& transmission = Finish(index);
+
+		if (transmission.Overlapped)
+		{
+			Result.Corrupted++;
+		}
+		else
+		{
+			Result.Delivered++;
+			Result.DeliveredBytes += node.Queue.PeekSize();
+		}
+
+		// As OnQueuedPacketSent(), the driver can't tell a corrupted one.
+		const uint32_t latency = node.SendStart - node.Queue.PeekQueuedAt();
+		Result.Latencies.push_back(latency);
+		if (node.Queue.PeekPriority() == UrgentClass)
+		{
+			Result.UrgentLatencies.push_back(latency);
+		}
+		node.Queue.Pop();
+		node.HeadScheduled = false;
+
+		if (!node.Queue.IsEmpty())
+		{
+			SchedulePoll(index, Now);
+		}
+	}
+
+	void OnCollision(const uint16_t index)
+	{
+		SimNode& node = Nodes[index];
+		Finish(index);
+
+		Result.Collisions++;
+		Backoff(node);
+		if (!node.Queue.IsEmpty())
+		{
+			SchedulePoll(index, Now + node.BackoffInterval);
+		}
+	}
+};
+
+struct WorkItem
+{
+	SimPoint Point;
+	uint32_t PointIndex;
+	uint32_t BusIndex;
+};
+
+static void RunWorker(const SimConfig* config, const std::vector<WorkItem>* items,
+	std::vector<BusResult>* results, std::atomic<size_t>* next)
+{
+	for (size_t i = next->fetch_add(1); i < items->size(); i = next->fetch_add(1))
+	{
+		const WorkItem& item = (*items)[i];
+		(*results)[i] = BusResult();
+		SimBus bus(*config, item.Point, item.PointIndex, item.BusIndex, (*results)[i]);
+		bus.Run();
+	}
+}
+
+// Lines are handed out one at a time, results land in item order.
+static void RunAll(const SimConfig& config, const std::vector<WorkItem>& items,
+	std::vector<BusResult>& results, const uint32_t threadCount)
+{
+	results.resize(items.size());
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		threads.emplace_back(RunWorker, &config, &items, &results, &next);
+	}
+	RunWorker(&config, &items, &results, &next);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+static const uint32_t GetPercentile(std::vector<uint32_t>& values, const double percentile)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+
+	const size_t index = std::min(values.size() - 1, (size_t)(percentile * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+
+	return values[index];
+}
+
+static std::vector<double> ParseList(const char* text)
+{
+	std::vector<double> values;
+	while (text != nullptr && *text != 0)
+	{
+		char* end = nullptr;
+		values.push_back(strtod(text, &end));
+		text = (*end == ',') ? end + 1 : nullptr;
+	}
+	return values;
+}
+
+static const PacketSizeType ClampSize(const double size)
+{
+	return (PacketSizeType)std::min<double>(std::max<double>(size, Constants::MinDataBytes), SimMaxPacketSize);
+}
+
+int main(int argc, char** argv)
+{
+	SimConfig config = { 32, 16, 4, 0.1, 20000, 10000000, 50, 8, 1 };
+	bool header = true;
+	std::vector<double> nodes = { 8, 16, 32 };
+	std::vector<double> rates = { 1, 5, 20 };
+	std::vector<double> threadCounts = { 1, 2, 4, 8 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--no-header") == 0) header = false;
+		else if (i + 1 < argc)
+		{
+			const char* value = argv[++i];
+			if (strcmp(argv[i - 1], "--buses") == 0) config.Buses = (uint32_t)atol(value);
+			else if (strcmp(argv[i - 1], "--nodes") == 0) nodes = ParseList(value);
+			else if (strcmp(argv[i - 1], "--rate") == 0) rates = ParseList(value);
+			else if (strcmp(argv[i - 1], "--size") == 0) config.BulkSize = ClampSize(atof(value));
+			else if (strcmp(argv[i - 1], "--urgent") == 0) config.UrgentShare = atof(value);
+			else if (strcmp(argv[i - 1], "--urgent-size") == 0) config.UrgentSize = ClampSize(atof(value));
+			else if (strcmp(argv[i - 1], "--deadline") == 0) config.Deadline = (uint32_t)atol(value);
+			else if (strcmp(argv[i - 1], "--seconds") == 0) config.DurationMicros = (uint64_t)(atof(value) * 1000000.0);
+			else if (strcmp(argv[i - 1], "--loop") == 0) config.LoopMicros = std::max<uint32_t>(1, (uint32_t)atol(value));
+			else if (strcmp(argv[i - 1], "--latency") == 0) config.LatencyMicros = (uint32_t)atol(value);
+			else if (strcmp(argv[i - 1], "--threads") == 0) threadCounts = ParseList(value);
+			else if (strcmp(argv[i - 1], "--seed") == 0) config.Seed = strtoull(value, nullptr, 10);
+		}
+	}
+
+	// Micros wrap like on the nodes, keep a line's run shorter than that.
+	if (config.Buses == 0 || config.DurationMicros == 0 || config.DurationMicros > UINT32_MAX / 2)
+	{
+		fprintf(stderr, "Need at least one bus, and up to %lu seconds.\n", (unsigned long)(UINT32_MAX / 2 / 1000000));
+		return 1;
+	}
+
+	std::vector<SimPoint> points;
+	for (double nodeCount : nodes)
+		for (double rate : rates)
+		{
+			if (nodeCount >= 1 && nodeCount <= UINT16_MAX && rate > 0)
+			{
+				points.push_back({ (uint16_t)nodeCount, rate });
+			}
+		}
+
+	std::vector<WorkItem> items;
+	for (uint32_t p = 0; p < points.size(); p++)
+		for (uint32_t b = 0; b < config.Buses; b++)
+		{
+			items.push_back({ points[p], p, b });
+		}
+
+	// Time the sweep per thread count, the first run gives the results.
+	std::vector<BusResult> reference;
+	std::vector<BusResult> results;
+	double baseMillis = 0;
+	std::vector<double> wallMillis;
+	std::vector<bool> identical;
+	for (size_t t = 0; t < threadCounts.size(); t++)
+	{
+		const uint32_t threadCount = (uint32_t)std::max<double>(threadCounts[t], 1);
+		const auto start = std::chrono::steady_clock::now();
+		RunAll(config, items, (t == 0) ? reference : results, threadCount);
+		const double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (t == 0)
+		{
+			baseMillis = millis;
+		}
+		wallMillis.push_back(millis);
+		identical.push_back(t == 0 || results == reference);
+	}
+
+	if (header)
+	{
+		printf("nodes,rate_pps,buses,size,urgent_share,offered,rejected,attempts,delivered,corrupted,collisions,"
+			"collision_rate,deferrals,dropped,expired,goodput_Bps,utilization,"
+			"latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,urgent_p99_us\n");
+	}
+
+	const double seconds = config.DurationMicros / 1000000.0;
+	uint64_t events = 0;
+	for (uint32_t p = 0; p < points.size(); p++)
+	{
+		BusResult total;
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			if (items[i].PointIndex != p)
+			{
+				continue;
+			}
+
+			const BusResult& bus = reference[i];
+			total.Events += bus.Events;
+			total.Offered += bus.Offered;
+			total.Rejected += bus.Rejected;
+			total.Attempts += bus.Attempts;
+			total.Delivered += bus.Delivered;
+			total.DeliveredBytes += bus.DeliveredBytes;
+			total.Corrupted += bus.Corrupted;
+			total.Overlapped += bus.Overlapped;
+			total.Collisions += bus.Collisions;
+			total.Deferrals += bus.Deferrals;
+			total.Dropped += bus.Dropped;
+			total.Expired += bus.Expired;
+			total.AirtimeMicros += bus.AirtimeMicros;
+			total.Latencies.insert(total.Latencies.end(), bus.Latencies.begin(), bus.Latencies.end());
+			total.UrgentLatencies.insert(total.UrgentLatencies.end(), bus.UrgentLatencies.begin(), bus.UrgentLatencies.end());
+		}
+		events += total.Events;
+
+		const double collisionRate = total.Attempts > 0 ? (double)total.Overlapped / total.Attempts : 0;
+		const double goodput = total.DeliveredBytes / (seconds * config.Buses);
+		const double utilization = total.AirtimeMicros / ((double)config.DurationMicros * config.Buses);
+		const uint32_t latencyMax = total.Latencies.empty() ? 0 : *std::max_element(total.Latencies.begin(), total.Latencies.end());
+
+		printf("%u,%g,%lu,%u,%g,%llu,%llu,%llu,%llu,%llu,%llu,%.6f,%llu,%llu,%llu,%.1f,%.4f,%lu,%lu,%lu,%lu,%lu\n",
+			(unsigned)points[p].Nodes, points[p].Rate, (unsigned long)config.Buses,
+			(unsigned)config.BulkSize, config.UrgentShare,
+			(unsigned long long)total.Offered, (unsigned long long)total.Rejected,
+			(unsigned long long)total.Attempts, (unsigned long long)total.Delivered,
+			(unsigned long long)total.Corrupted, (unsigned long long)total.Collisions,
+			collisionRate, (unsigned long long)total.Deferrals,
+			(unsigned long long)total.Dropped, (unsigned long long)total.Expired,
+			goodput, utilization,
+			(unsigned long)GetPercentile(total.Latencies, 0.5),
+			(unsigned long)GetPercentile(total.Latencies, 0.9),
+			(unsigned long)GetPercentile(total.Latencies, 0.99),
+			(unsigned long)latencyMax,
+			(unsigned long)GetPercentile(total.UrgentLatencies, 0.99));
+	}
+
+	printf("# threads,wall_ms,speedup,events_per_s,identical\n");
+	for (size_t t = 0; t < threadCounts.size(); t++)
+	{
+		printf("# %u,%.1f,%.2f,%.0f,%s\n",
+			(unsigned)std::max<double>(threadCounts[t], 1), wallMillis[t],
+			wallMillis[t] > 0 ? baseMillis / wallMillis[t] : 0,
+			wallMillis[t] > 0 ? events * 1000.0 / wallMillis[t] : 0,
+			identical[t] ? "yes" : "no");
+	}
+
+	return 0;
+}
\ No newline at end of file
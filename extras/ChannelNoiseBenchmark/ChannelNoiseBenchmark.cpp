@@ -0,0 +1,400 @@
+// ChannelNoiseBenchmark.cpp
+// Monte-Carlo benchmark of the PacketWriter to PacketReader link over a simulated channel.
+// The channel adds Gaussian jitter, clock skew, dropped pulses and spurious glitch pulses.
+// Sweeps packet size and channel parameters and prints one CSV row per point:
+// packet error rate, goodput and loss detection latency.
+//
+// The timing profile is compile time, sweep it with one build per profile:
+// for t in 8 11 14 17; do
+//	g++ -O2 -std=c++11 -DPIM_HOST -DPIM_INTERVAL_TOLERANCE=$t -I extras/Host -I src extras/ChannelNoiseBenchmark/ChannelNoiseBenchmark.cpp src/PulseIntervalModulator/PacketWriter.cpp -o bench_$t
+//	./bench_$t --no-header >> per.csv
+// done
+// Link options are compile time too, build with -DPIM_FEC to measure the Hamming code.
+// --glitch-offset places one glitch per packet at a fixed time from the start pulse, to check PIM_RESYNC:
+// ./bench --sizes 16 --jitter 2 --skew 0 --drop 0 --glitch 0 --glitch-offset -300,-100,-20,20,100,150
+// Build it with and without -DPIM_RESYNC, the resyncs column needs -DPIM_READER_STATS, it stays 0 without.
+//
+// Noise is applied per edge, the interval jitter is sqrt(2) times the edge jitter.
+//
+// Usage:
+// ChannelNoiseBenchmark [options]
+//	--packets <n>		Packets per point, default 2000.
+//	--seed <n>			Random seed, default 1.
+//	--sizes <a,b,..>	Packet sizes, default 1,16,64.
+//	--jitter <a,b,..>	Edge jitter standard deviation in us, default 0,2,4,6,8.
+//	--skew <a,b,..>		Receiver clock skew in ppm, default 0,5000.
+//	--drop <a,b,..>		Pulse drop probability, default 0,0.001.
+//	--glitch <a,b,..>	Glitch pulses per ms, default 0,0.5.
+//	--glitch-offset <a,b,..>	One extra glitch per packet at this time in us from the start pulse, negative is before, default none.
+//	--no-header			Don't print the CSV header.
+//	--fast				Fast payload rate, built with -DPIM_RATE_SWITCHING.
+
+#define PIM_SILENCE_TIMEOUT
+
+#include <PulseIntervalModulator/PacketReader.h>
+#include <PulseIntervalModulator/PacketWriter.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static const uint8_t ReadPin = 2;
+static const uint8_t WritePin = 7;
+
+static std::vector<uint32_t>* PulseCapture = nullptr;
+
+static void OnPinWrite(const uint8_t pin, const uint8_t value)
+{
+	if (pin == WritePin && value == HIGH && PulseCapture != nullptr)
+	{
+		PulseCapture->push_back(micros());
+	}
+}
+
+struct ChannelParameters
+{
+	double JitterMicros;
+	double SkewPpm;
+	double DropProbability;
+	double GlitchesPerMilli;
+	bool PlaceGlitch;
+	double GlitchOffsetMicros;
+};
+
+struct PointResult
+{
+	uint32_t Packets = 0;
+	uint32_t Received = 0;
+	uint32_t Corrupted = 0; // Received, but with a different payload.
+	uint32_t LostReported = 0;
+	uint64_t PayloadBytes = 0;
+	uint64_t ElapsedMicros = 0;
+	uint64_t LossLatencySum = 0;
+	uint32_t Resyncs = 0;
+};
+
+class ChannelLink
+{
+private:
+	class LinkReaderHandler : public PacketReaderHandler
+	{
+	private:
+		ChannelLink* Link;
+
+	public:
+		LinkReaderHandler(ChannelLink* link) : Link(link) {}
+
+		void OnPacketReceived(const uint32_t startTimestamp)
+		{
+			Link->PendingReceived = true;
+		}
+
+		void OnPacketLost(const uint32_t startTimestamp)
+		{
+			Link->PendingLost = true;
+		}
+	};
+
+	class LinkWriterHandler : public PacketWriterHandler
+	{
+	};
+
+	uint8_t IncomingBuffer[Constants::MaxDataBytes];
+
+	TemplatePacketReader<LinkReaderHandler> Reader;
+	TemplatePacketWriter<LinkWriterHandler> Writer;
+
+	std::vector<uint32_t> Pulses;
+	std::vector<double> Edges;
+
+	std::mt19937_64 Random;
+
+	bool PendingReceived = false;
+	bool PendingLost = false;
+
+	uint32_t Now = 1000;
+
+public:
+	ChannelLink(const uint64_t seed)
+		: Reader(LinkReaderHandler(this), IncomingBuffer, Constants::MaxDataBytes, ReadPin)
+		, Writer(LinkWriterHandler(), Constants::MaxDataBytes, WritePin)
+		, Random(seed)
+	{
+		HostPinListener() = OnPinWrite;
+		PulseCapture = &Pulses;
+		Reader.Start();
+		Writer.Start();
+	}
+
+#if defined(PIM_RATE_SWITCHING)
+	void SetFastRate(const bool fastRate)
+	{
+		Writer.SetFastRate(fastRate);
+	}
+#endif
+
+	void RunPoint(const PacketSizeType packetSize, const ChannelParameters& channel, const uint32_t packets, PointResult& result)
+	{
+		std::uniform_int_distribution<int> byteDistribution(0, UINT8_MAX);
+		uint8_t payload[Constants::MaxDataBytes];
+
+#if defined(PIM_READER_STATS)
+		Reader.ClearStats();
+#endif
+
+		for (uint32_t p = 0; p < packets; p++)
+		{
+			for (PacketSizeType i = 0; i < packetSize; i++)
+			{
+				payload[i] = (uint8_t)byteDistribution(Random);
+			}
+
+			// Keep a glitch before the start pulse clear of the previous packet.
+			if (channel.PlaceGlitch && channel.GlitchOffsetMicros < 0)
+			{
+				Now += (uint32_t)(-channel.GlitchOffsetMicros);
+			}
+
+			const uint32_t start = Now;
+			Transmit(payload, packetSize);
+			ApplyChannel(channel, start);
+
+			// Deliver to the reader.
+			bool received = false;
+			bool lost = false;
+			uint32_t lostTimestamp = 0;
+			uint32_t last = start;
+			for (size_t i = 0; i < Edges.size(); i++)
+			{
+				const uint32_t edge = (uint32_t)std::max(0.0, Edges[i] + 0.5);
+				HostMicros() = edge;
+				Reader.CheckTimeout();
+				Reader.OnPulse();
+				last = edge;
+
+				Collect(payload, packetSize, received, lost, lostTimestamp, result);
+			}
+
+			// Silence until the next packet, truncated packets time out here.
+			Now = std::max(Now, last) + Constants::SendSilenceInterval;
+			HostMicros() = last + Constants::SilenceTimeoutInterval + 1;
+			Reader.CheckTimeout();
+			Collect(payload, packetSize, received, lost, lostTimestamp, result);
+
+			if (lost)
+			{
+				result.LostReported++;
+				result.LossLatencySum += lostTimestamp - start;
+			}
+
+			result.Packets++;
+			result.ElapsedMicros += Now - start;
+		}
+
+#if defined(PIM_READER_STATS)
+		PacketReaderStats stats;
+		Reader.GetStats(stats);
+		result.Resyncs = stats.Resyncs;
+#endif
+	}
+
+private:
+	void Transmit(uint8_t* payload, const PacketSizeType packetSize)
+	{
+		Pulses.clear();
+		HostMicros() = Now;
+		Writer.SendPacket(payload, packetSize);
+
+		InterruptTimerWrapper& timer = Writer.GetTimerWrapper();
+		while (timer.IsArmed())
+		{
+			HostMicros() = timer.GetDeadline();
+			timer.Fire();
+		}
+		Now = HostMicros();
+	}
+
+	void ApplyChannel(const ChannelParameters& channel, const uint32_t start)
+	{
+		std::normal_distribution<double> jitter(0, channel.JitterMicros > 0 ? channel.JitterMicros : 1);
+		std::uniform_real_distribution<double> uniform(0, 1);
+
+		const double scale = 1.0 + (channel.SkewPpm / 1000000.0);
+
+		Edges.clear();
+		for (size_t i = 0; i < Pulses.size(); i++)
+		{
+			if (uniform(Random) < channel.DropProbability)
+			{
+				continue;
+			}
+
+			double edge = start + ((double)(Pulses[i] - start) * scale);
+			if (channel.JitterMicros > 0)
+			{
+				edge += jitter(Random);
+			}
+			Edges.push_back(edge);
+		}
+
+		// Poisson glitches over the packet span.
+		if (channel.GlitchesPerMilli > 0 && !Pulses.empty())
+		{
+			const double span = (double)(Pulses.back() - start) * scale;
+			std::poisson_distribution<int> glitchCount((span / 1000.0) * channel.GlitchesPerMilli);
+			const int count = glitchCount(Random);
+			for (int i = 0; i < count; i++)
+			{
+				Edges.push_back(start + (uniform(Random) * span));
+			}
+		}
+
+		if (channel.PlaceGlitch && !Pulses.empty())
+		{
+			Edges.push_back(Pulses.front() + (channel.GlitchOffsetMicros * scale));
+		}
+
+		std::sort(Edges.begin(), Edges.end());
+	}
+
+
+	void Collect(const uint8_t* payload, const PacketSizeType packetSize, bool& received, bool& lost, uint32_t& lostTimestamp, PointResult& result)
+	{
+		if (PendingLost)
+		{
+			PendingLost = false;
+			if (!lost && !received)
+			{
+				lost = true;
+				lostTimestamp = micros();
+			}
+		}
+
+		if (PendingReceived)
+		{
+			PendingReceived = false;
+
+			PacketSizeType size = 0;
+			if (Reader.HasIncoming(size) && !received)
+			{
+				received = true;
+				if (size == packetSize && memcmp(IncomingBuffer, payload, size) == 0)
+				{
+					result.Received++;
+					result.PayloadBytes += size;
+				}
+				else
+				{
+					result.Corrupted++;
+				}
+			}
+			Reader.Restore();
+		}
+	}
+};
+
+static std::vector<double> ParseList(const char* text)
+{
+	std::vector<double> values;
+	while (text != nullptr && *text != 0)
+	{
+		char* end = nullptr;
+		values.push_back(strtod(text, &end));
+		text = (*end == ',') ? end + 1 : nullptr;
+	}
+	return values;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t packets = 2000;
+	uint64_t seed = 1;
+	bool header = true;
+	bool fastRate = false;
+	std::vector<double> sizes = { 1, 16, 64 };
+	std::vector<double> jitters = { 0, 2, 4, 6, 8 };
+	std::vector<double> skews = { 0, 5000 };
+	std::vector<double> drops = { 0, 0.001 };
+	std::vector<double> glitches = { 0, 0.5 };
+	std::vector<double> glitchOffsets;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--no-header") == 0) header = false;
+		else if (strcmp(argv[i], "--fast") == 0) fastRate = true;
+		else if (i + 1 < argc)
+		{
+			const char* value = argv[++i];
+			if (strcmp(argv[i - 1], "--packets") == 0) packets = (uint32_t)atol(value);
+			else if (strcmp(argv[i - 1], "--seed") == 0) seed = strtoull(value, nullptr, 10);
+			else if (strcmp(argv[i - 1], "--sizes") == 0) sizes = ParseList(value);
+			else if (strcmp(argv[i - 1], "--jitter") == 0) jitters = ParseList(value);
+			else if (strcmp(argv[i - 1], "--skew") == 0) skews = ParseList(value);
+			else if (strcmp(argv[i - 1], "--drop") == 0) drops = ParseList(value);
+			else if (strcmp(argv[i - 1], "--glitch") == 0) glitches = ParseList(value);
+			else if (strcmp(argv[i - 1], "--glitch-offset") == 0) glitchOffsets = ParseList(value);
+		}
+	}
+
+	if (header)
+	{
+		printf("preamble_us,zero_us,one_us,tolerance_us,size,jitter_us,skew_ppm,drop_prob,glitch_per_ms,glitch_offset_us,"
+			"packets,received,corrupted,lost_reported,per,goodput_Bps,loss_latency_us,resyncs\n");
+	}
+
+	ChannelLink link(seed);
+#if defined(PIM_RATE_SWITCHING)
+	link.SetFastRate(fastRate);
+#else
+	if (fastRate)
+	{
+		fprintf(stderr, "--fast needs PIM_RATE_SWITCHING.\n");
+		return 1;
+	}
+#endif
+
+	// No offsets runs each point once without a placed glitch.
+	const bool placeGlitch = !glitchOffsets.empty();
+	if (!placeGlitch)
+	{
+		glitchOffsets.push_back(0);
+	}
+
+	for (double size : sizes)
+	{
+		const PacketSizeType packetSize = (PacketSizeType)std::min<double>(std::max<double>(size, Constants::MinDataBytes), Constants::MaxDataBytes);
+		for (double jitter : jitters)
+			for (double skew : skews)
+				for (double drop : drops)
+					for (double glitch : glitches)
+						for (double glitchOffset : glitchOffsets)
+						{
+							const ChannelParameters channel = { jitter, skew, drop, glitch, placeGlitch, glitchOffset };
+							PointResult result;
+							link.RunPoint(packetSize, channel, packets, result);
+
+							const double per = 1.0 - ((double)result.Received / result.Packets);
+							const double goodput = result.ElapsedMicros > 0 ? (result.PayloadBytes * 1000000.0) / result.ElapsedMicros : 0;
+							const double latency = result.LostReported > 0 ? (double)result.LossLatencySum / result.LostReported : 0;
+
+							char offsetText[16] = "";
+							if (placeGlitch)
+							{
+								snprintf(offsetText, sizeof(offsetText), "%g", glitchOffset);
+							}
+
+							printf("%lu,%lu,%lu,%u,%u,%g,%g,%g,%g,%s,%lu,%lu,%lu,%lu,%.6f,%.1f,%.1f,%lu\n",
+								(unsigned long)Constants::PreambleInterval, (unsigned long)Constants::ZeroInterval,
+								(unsigned long)Constants::OneInterval, Constants::IntervalTolerance,
+								(unsigned)packetSize, jitter, skew, drop, glitch, offsetText,
+								(unsigned long)result.Packets, (unsigned long)result.Received,
+								(unsigned long)result.Corrupted, (unsigned long)result.LostReported,
+								per, goodput, latency, (unsigned long)result.Resyncs);
+						}
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,585 @@
+// CompressionBenchmark.cpp
+// PulseLzss against the uncompressed path, over a simulated PacketWriter to PacketReader link.
+// Both paths stream (PIM_STREAMING): the raw one copies bytes, the compressed one runs
+// the encoder in GetStreamByte() and the decoder in OnStreamByte(), so only compression differs.
+// Prints one CSV row per corpus and packet size: compression ratio, airtime of both paths,
+// and CPU cost per call of the encoder and decoder (interrupt) and of the size pre-pass (main loop).
+// A lossy run then cuts packets and acknowledges off the line, unnoticed by the receiver, and flips a bit in others:
+// the sender repeats a packet until the decoder's size acknowledges it, and the decoder must refuse repeats, gaps
+// and packets it found corrupt. The first packet is always flipped into a match before the start, as a corrupt one.
+// A flip the decoder can't see is dropped as an application CRC would.
+// Without acknowledges, the decoder must stop at the first lost packet, never decode past it.
+//
+// The format is compile time, sweep it with one build per format:
+// g++ -O2 -std=c++11 -DPIM_HOST -DLZSS_OFFSET_BITS=10 -DLZSS_LENGTH_BITS=5 -DLZSS_HASH_BITS=8 -I extras/Host -I src extras/CompressionBenchmark/CompressionBenchmark.cpp src/PulseIntervalModulator/PacketWriter.cpp -o CompressionBenchmark
+// Link options are compile time too, build with -DPIM_EXTENDED_HEADER for packets over 64 bytes.
+//
+// Usage:
+// CompressionBenchmark [options]
+//	--size <n>			Corpus size in bytes, default 4096.
+//	--sizes <a,b,..>	Packet sizes, default 16,32,64.
+//	--seed <n>			Random seed, default 1.
+//	--loss <p>			Packet and acknowledge loss of the lossy runs, default 0.05.
+//	--flip <p>			Packets with a flipped bit in the lossy run, default 0.05.
+//	--file <path>		Also runs a file, up to --size bytes of it.
+//	--no-header			Don't print the CSV header.
+//
+// Host timings are not AVR cycle counts, compare them between builds on the same machine.
+
+#if !defined(PIM_STREAMING)
+#define PIM_STREAMING
+#endif
+
+#include <PulseIntervalModulator/PacketReader.h>
+#include <PulseIntervalModulator/PacketWriter.h>
+#include <PulsePacket/PulseLzss.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#if !defined(LZSS_OFFSET_BITS)
+#define LZSS_OFFSET_BITS 8
+#endif
+
+#if !defined(LZSS_LENGTH_BITS)
+#define LZSS_LENGTH_BITS 4
+#endif
+
+#if !defined(LZSS_HASH_BITS)
+#define LZSS_HASH_BITS 6
+#endif
+
+static const uint8_t ReadPin = 2;
+static const uint8_t WritePin = 7;
+
+// Sends of one packet in the lossy run.
+static const uint32_t MaxAttempts = 64;
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+typedef PulseLzssEncoder<LZSS_OFFSET_BITS, LZSS_LENGTH_BITS, LZSS_HASH_BITS> EncoderType;
+typedef PulseLzssDecoder<LZSS_OFFSET_BITS, LZSS_LENGTH_BITS> DecoderType;
+typedef PulseLzssFormat<LZSS_OFFSET_BITS, LZSS_LENGTH_BITS> FormatType;
+
+// Set while a lost packet is sent, the reader sees nothing of it.
+static bool LineCut = false;
+
+static void OnPinWrite(const uint8_t pin, const uint8_t value)
+{
+	if (!LineCut && pin == WritePin && value == HIGH)
+	{
+		HostRaisePin(ReadPin);
+	}
+}
+
+static double ClockOverhead = 0;
+
+static double ElapsedNanos(const BenchmarkClock::time_point start)
+{
+	const double elapsed = std::chrono::duration<double, std::nano>(BenchmarkClock::now() - start).count() - ClockOverhead;
+
+	return elapsed > 0 ? elapsed : 0;
+}
+
+// The 99th percentile stands for the worst case, the maximum is host preemption.
+struct CallStats
+{
+	std::vector<double> Samples;
+	double Total = 0;
+
+	void Add(const double nanos)
+	{
+		Samples.push_back(nanos);
+		Total += nanos;
+	}
+
+	double GetAverage() const
+	{
+		return Samples.empty() ? 0 : Total / Samples.size();
+	}
+
+	double GetPercentile99()
+	{
+		if (Samples.empty())
+		{
+			return 0;
+		}
+
+		std::sort(Samples.begin(), Samples.end());
+
+		return Samples[((Samples.size() - 1) * 99) / 100];
+	}
+};
+
+struct TransferResult
+{
+	uint32_t Packets = 0;
+	uint32_t WireBytes = 0;
+	uint64_t ElapsedMicros = 0;
+	uint32_t Lost = 0;
+	uint32_t Flipped = 0;
+	uint32_t Repeats = 0;
+	uint32_t Rejected = 0;
+	uint32_t Corrupt = 0;
+	bool Ok = false;
+	CallStats Encode;
+	CallStats Decode;
+	CallStats PrePass;
+};
+
+class CompressionLink
+{
+private:
+	class LinkReaderHandler : public PacketReaderHandler
+	{
+	private:
+		CompressionLink* Link;
+
+	public:
+		LinkReaderHandler(CompressionLink* link) : Link(link) {}
+
+		void OnStreamByte(const PacketSizeType byteIndex, const uint8_t value)
+		{
+			Link->OnStreamByte(byteIndex, value);
+		}
+
+		void OnPacketReceived(const uint32_t startTimestamp)
+		{
+			Link->PendingReceived = true;
+		}
+	};
+
+	class LinkWriterHandler : public PacketWriterHandler
+	{
+	private:
+		CompressionLink* Link;
+
+	public:
+		LinkWriterHandler(CompressionLink* link) : Link(link) {}
+
+		const uint8_t GetStreamByte(const PacketSizeType byteIndex)
+		{
+			return Link->GetStreamByte(byteIndex);
+		}
+	};
+
+	TemplatePacketReader<LinkReaderHandler> Reader;
+	TemplatePacketWriter<LinkWriterHandler> Writer;
+
+	EncoderType Encoder;
+	DecoderType Decoder;
+
+	const uint8_t* Source = nullptr;
+	uint8_t* Destination = nullptr;
+
+	// Source offset of the packet.
+	uint32_t Offset = 0;
+
+	bool Compress = false;
+	bool PendingReceived = false;
+
+	TransferResult* Result = nullptr;
+
+	uint32_t Now = 1000;
+
+	std::mt19937 Random;
+	double Loss = 0;
+	double Flip = 0;
+
+	// Received byte and bit flipped in the current packet, if any.
+	bool Flipping = false;
+	PacketSizeType FlipIndex = 0;
+	uint8_t FlipMask = 0;
+
+public:
+	CompressionLink(const uint32_t seed)
+		: Reader(LinkReaderHandler(this), nullptr, Constants::MaxDataBytes, ReadPin)
+		, Writer(LinkWriterHandler(this), Constants::MaxDataBytes, WritePin)
+		, Random(seed)
+	{
+		HostPinListener() = OnPinWrite;
+		Reader.Start();
+		Writer.Start();
+	}
+
+	// Each packet and acknowledge is lost with probability loss, each packet has a bit flipped with probability flip.
+	// Without acknowledges, lost packets aren't repeated and the result is only ok
+	// if the decoder kept everything before the first one, and nothing after.
+	void Run(const std::vector<uint8_t>& source, const PacketSizeType packetSize, const bool compress,
+		const double loss, const double flip, const bool acknowledge, TransferResult& result)
+	{
+		std::vector<uint8_t> destination(source.size(), 0);
+
+		Source = source.data();
+		Destination = destination.data();
+		Compress = compress;
+		Result = &result;
+		Offset = 0;
+		Loss = loss;
+		Flip = flip;
+
+		uint32_t expectedSize = (uint32_t)source.size();
+
+		if (Compress)
+		{
+			Encoder.Start(Source, (uint16_t)source.size());
+			Decoder.Start(Destination, (uint16_t)destination.size());
+		}
+
+		const uint32_t start = Now;
+		uint32_t attempts = 0;
+		bool corruptSent = false;
+		while (Compress ? !Encoder.IsDone() : Offset < source.size())
+		{
+			PacketSizeType wireSize = 0;
+			uint32_t sourceUsed = 0;
+			if (Compress)
+			{
+				const BenchmarkClock::time_point prePassStart = BenchmarkClock::now();
+				wireSize = Encoder.NextPacket(packetSize);
+				result.PrePass.Add(ElapsedNanos(prePassStart));
+				sourceUsed = Encoder.GetSourceUsed();
+			}
+			else
+			{
+				wireSize = (PacketSizeType)std::min<uint32_t>(packetSize, source.size() - Offset);
+				sourceUsed = wireSize;
+			}
+
+			const bool lost = Draw(Loss);
+			Flipping = !lost && Draw(Flip);
+			if (Compress && !lost && Flip > 0 && !corruptSent)
+			{
+				// Second token's flag, after the first literal is written. Text starts with literals,
+				// the second becomes a match reaching before the start.
+				corruptSent = true;
+				Flipping = true;
+				FlipIndex = FormatType::HeaderSize + 1;
+				FlipMask = 0x80 >> (FormatType::LiteralBits - 8);
+			}
+			else if (Flipping)
+			{
+				FlipIndex = (PacketSizeType)(Random() % wireSize);
+				FlipMask = (uint8_t)(1 << (Random() % 8));
+			}
+			result.Flipped += Flipping ? 1 : 0;
+
+			if (!Transmit(wireSize, lost) && !lost)
+			{
+				return;
+			}
+
+			result.Packets++;
+			result.WireBytes += wireSize;
+
+			if (lost)
+			{
+				result.Lost++;
+				if (!acknowledge && expectedSize == source.size())
+				{
+					expectedSize = Offset;
+				}
+			}
+			else if (Compress)
+			{
+				// A packet the decoder found corrupt is up to CommitPacket().
+				const uint16_t packetStart = Encoder.GetSourceOffset();
+				result.Corrupt += Decoder.IsCorrupt() ? 1 : 0;
+				if (!Decoder.IsCorrupt()
+					&& Decoder.GetSize() >= packetStart
+					&& (Decoder.GetSize() != packetStart + sourceUsed
+						|| memcmp(&Source[packetStart], &Destination[packetStart], sourceUsed) != 0))
+				{
+					Decoder.DropPacket();
+					result.Rejected++;
+				}
+				else if (!Decoder.CommitPacket())
+				{
+					result.Rejected++;
+				}
+			}
+
+			if (acknowledge
+				&& (Draw(Loss) || Decoder.GetSize() != Encoder.GetSourceOffset() + sourceUsed))
+			{
+				// A decoder that never catches up fails the transfer.
+				if (++attempts > MaxAttempts)
+				{
+					return;
+				}
+				Encoder.RepeatPacket();
+				result.Repeats++;
+				continue;
+			}
+			attempts = 0;
+			Offset += sourceUsed;
+		}
+		result.ElapsedMicros = Now - start;
+
+		const bool complete = !Compress || (Decoder.GetSize() == expectedSize && !Decoder.IsCorrupt());
+		result.Ok = complete && memcmp(Source, Destination, expectedSize) == 0;
+	}
+
+private:
+	const bool Draw(const double probability)
+	{
+		return probability > 0 && std::uniform_real_distribution<double>(0, 1)(Random) < probability;
+	}
+
+	const bool Transmit(const PacketSizeType wireSize, const bool lost)
+	{
+		PendingReceived = false;
+		HostMicros() = Now;
+		LineCut = lost;
+		Writer.SendStream(wireSize);
+
+		InterruptTimerWrapper& timer = Writer.GetTimerWrapper();
+		while (timer.IsArmed())
+		{
+			HostMicros() = timer.GetDeadline();
+			timer.Fire();
+		}
+		LineCut = false;
+
+		// Silence until the next packet.
+		Now = HostMicros() + Constants::SendSilenceInterval;
+
+		PacketSizeType size = 0;
+		const bool received = PendingReceived && Reader.HasIncoming(size) && size == wireSize;
+		Reader.Restore();
+
+		return received;
+	}
+
+	const uint8_t GetStreamByte(const PacketSizeType byteIndex)
+	{
+		if (!Compress)
+		{
+			return Source[Offset + byteIndex];
+		}
+
+		const BenchmarkClock::time_point start = BenchmarkClock::now();
+		const uint8_t value = Encoder.GetByte();
+		Result->Encode.Add(ElapsedNanos(start));
+
+		return value;
+	}
+
+	void OnStreamByte(const PacketSizeType byteIndex, uint8_t value)
+	{
+		if (Flipping && byteIndex == FlipIndex)
+		{
+			value ^= FlipMask;
+		}
+
+		if (!Compress)
+		{
+			Destination[Offset + byteIndex] = value;
+			return;
+		}
+
+		const BenchmarkClock::time_point start = BenchmarkClock::now();
+		Decoder.Push(value);
+		Result->Decode.Add(ElapsedNanos(start));
+	}
+};
+
+// Key=value settings, keys and most values repeat.
+static std::vector<uint8_t> MakeConfig(const size_t size, std::mt19937& random)
+{
+	static const char* const Sections[] = { "adc", "pwm", "uart", "link" };
+	static const char* const Keys[] = { "enabled", "sample_rate", "gain", "offset", "threshold", "mode" };
+	static const char* const Modes[] = { "auto", "manual", "off" };
+
+	std::string text;
+	while (text.size() < size)
+	{
+		char line[64];
+		const uint32_t section = random() % 4;
+		const uint32_t key = random() % 6;
+		if (key == 5)
+		{
+			snprintf(line, sizeof(line), "%s.%s=%s\n", Sections[section], Keys[key], Modes[random() % 3]);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "%s.%s=%u\n", Sections[section], Keys[key], (unsigned)(random() % 1000));
+		}
+		text += line;
+	}
+
+	return std::vector<uint8_t>(text.begin(), text.begin() + size);
+}
+
+// CSV log table, slowly changing values.
+static std::vector<uint8_t> MakeLog(const size_t size, std::mt19937& random)
+{
+	std::string text = "timestamp,node,channel,value,status\n";
+	uint32_t timestamp = 100000;
+	int32_t value = 512;
+	while (text.size() < size)
+	{
+		char line[64];
+		timestamp += 250 + (random() % 8);
+		value += (int32_t)(random() % 9) - 4;
+		snprintf(line, sizeof(line), "%lu,%u,%u,%ld,%s\n", (unsigned long)timestamp, (unsigned)(1 + (random() % 3)),
+			(unsigned)(random() % 4), (long)value, (random() % 16) == 0 ? "WARN" : "OK");
+		text += line;
+	}
+
+	return std::vector<uint8_t>(text.begin(), text.begin() + size);
+}
+
+// Incompressible, the worst case.
+static std::vector<uint8_t> MakeRandom(const size_t size, std::mt19937& random)
+{
+	std::vector<uint8_t> data(size);
+	for (size_t i = 0; i < size; i++)
+	{
+		data[i] = (uint8_t)random();
+	}
+
+	return data;
+}
+
+static std::vector<double> ParseList(const char* text)
+{
+	std::vector<double> values;
+	while (text != nullptr && *text != 0)
+	{
+		char* end = nullptr;
+		values.push_back(strtod(text, &end));
+		text = (*end == ',') ? end + 1 : nullptr;
+	}
+	return values;
+}
+
+int main(int argc, char** argv)
+{
+	size_t corpusSize = 4096;
+	uint32_t seed = 1;
+	double loss = 0.05;
+	double flip = 0.05;
+	bool header = true;
+	const char* path = nullptr;
+	std::vector<double> sizes = { 16, 32, 64 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--no-header") == 0) header = false;
+		else if (i + 1 < argc)
+		{
+			const char* value = argv[++i];
+			if (strcmp(argv[i - 1], "--size") == 0) corpusSize = (size_t)atol(value);
+			else if (strcmp(argv[i - 1], "--sizes") == 0) sizes = ParseList(value);
+			else if (strcmp(argv[i - 1], "--seed") == 0) seed = (uint32_t)atol(value);
+			else if (strcmp(argv[i - 1], "--file") == 0) path = value;
+			else if (strcmp(argv[i - 1], "--loss") == 0) loss = atof(value);
+			else if (strcmp(argv[i - 1], "--flip") == 0) flip = atof(value);
+		}
+	}
+
+	// Positions are 16 bit.
+	corpusSize = std::min<size_t>(std::max<size_t>(corpusSize, 1), UINT16_MAX);
+
+	std::vector<std::string> names;
+	std::vector<std::vector<uint8_t>> corpora;
+	std::mt19937 random(seed);
+	names.push_back("config");
+	corpora.push_back(MakeConfig(corpusSize, random));
+	names.push_back("log");
+	corpora.push_back(MakeLog(corpusSize, random));
+	names.push_back("random");
+	corpora.push_back(MakeRandom(corpusSize, random));
+
+	if (path != nullptr)
+	{
+		FILE* file = fopen(path, "rb");
+		if (file == nullptr)
+		{
+			fprintf(stderr, "Unable to open %s\n", path);
+			return 1;
+		}
+
+		std::vector<uint8_t> data(corpusSize);
+		data.resize(fread(data.data(), 1, corpusSize, file));
+		fclose(file);
+
+		if (!data.empty())
+		{
+			names.push_back(path);
+			corpora.push_back(data);
+		}
+	}
+
+	std::vector<double> overheads;
+	for (uint32_t i = 0; i < 1001; i++)
+	{
+		const BenchmarkClock::time_point start = BenchmarkClock::now();
+		overheads.push_back(std::chrono::duration<double, std::nano>(BenchmarkClock::now() - start).count());
+	}
+	std::sort(overheads.begin(), overheads.end());
+	ClockOverhead = overheads[overheads.size() / 2];
+
+	if (header)
+	{
+		printf("corpus,packet_size,source_bytes,raw_packets,raw_us,packets,wire_bytes,ratio,compressed_us,speedup,"
+			"encode_ns_avg,encode_ns_p99,decode_ns_avg,decode_ns_p99,prepass_ns_avg,prepass_ns_p99,"
+			"lossy_packets,lost,flipped,repeats,rejected,corrupt\n");
+	}
+
+	CompressionLink link(seed);
+	bool failed = false;
+	for (size_t c = 0; c < corpora.size(); c++)
+	{
+		for (double size : sizes)
+		{
+			// The source offset and a literal take at least 4 bytes.
+			const PacketSizeType packetSize = (PacketSizeType)std::min<double>(std::max<double>(size, 4), Constants::MaxDataBytes);
+
+			TransferResult raw;
+			TransferResult compressed;
+			TransferResult lossy;
+			TransferResult unacknowledged;
+			link.Run(corpora[c], packetSize, false, 0, 0, false, raw);
+			link.Run(corpora[c], packetSize, true, 0, 0, false, compressed);
+			link.Run(corpora[c], packetSize, true, loss, flip, true, lossy);
+			link.Run(corpora[c], packetSize, true, loss, 0, false, unacknowledged);
+
+			if (!raw.Ok || !compressed.Ok || !lossy.Ok)
+			{
+				fprintf(stderr, "%s at %u bytes: transfer failed.\n", names[c].c_str(), (unsigned)packetSize);
+				failed = true;
+				continue;
+			}
+
+			if (!unacknowledged.Ok)
+			{
+				fprintf(stderr, "%s at %u bytes: decoded past a lost packet.\n", names[c].c_str(), (unsigned)packetSize);
+				failed = true;
+				continue;
+			}
+
+			printf("%s,%u,%u,%lu,%llu,%lu,%lu,%.3f,%llu,%.3f,%.1f,%.1f,%.1f,%.1f,%.0f,%.0f,%lu,%lu,%lu,%lu,%lu,%lu\n",
+				names[c].c_str(), (unsigned)packetSize, (unsigned)corpora[c].size(),
+				(unsigned long)raw.Packets, (unsigned long long)raw.ElapsedMicros,
+				(unsigned long)compressed.Packets, (unsigned long)compressed.WireBytes,
+				(double)corpora[c].size() / compressed.WireBytes,
+				(unsigned long long)compressed.ElapsedMicros,
+				(double)raw.ElapsedMicros / compressed.ElapsedMicros,
+				compressed.Encode.GetAverage(), compressed.Encode.GetPercentile99(),
+				compressed.Decode.GetAverage(), compressed.Decode.GetPercentile99(),
+				compressed.PrePass.GetAverage(), compressed.PrePass.GetPercentile99(),
+				(unsigned long)lossy.Packets, (unsigned long)lossy.Lost, (unsigned long)lossy.Flipped,
+				(unsigned long)lossy.Repeats, (unsigned long)lossy.Rejected, (unsigned long)lossy.Corrupt);
+		}
+	}
+
+	return failed ? 1 : 0;
+}
\ No newline at end of file
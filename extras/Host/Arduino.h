@@ -0,0 +1,110 @@
+// Arduino.h
+// Minimal Arduino core stand-in, for building the library on a host computer.
+// Time is simulated: host tools set HostMicros() before raising pins or firing timers.
+// Pin writes are forwarded to HostPinListener, pin interrupts are raised with HostRaisePin().
+// State is per thread, so independent simulations can run in parallel.
+//
+// Build with -DPIM_HOST -I extras/Host -I src
+
+#ifndef _HOST_ARDUINO_h
+#define _HOST_ARDUINO_h
+
+#if !defined(PIM_HOST)
+#define PIM_HOST
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// Flash and RAM are the same on host.
+#define PROGMEM
+#define memcpy_P memcpy
+
+#define F_CPU 16000000L
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+
+static const uint8_t HostPinCount = 64;
+
+inline uint32_t& HostMicros()
+{
+	static thread_local uint32_t Micros = 0;
+	return Micros;
+}
+
+inline void (*&HostPinListener())(const uint8_t pin, const uint8_t value)
+{
+	static thread_local void (*Listener)(const uint8_t pin, const uint8_t value) = nullptr;
+	return Listener;
+}
+
+inline void (**HostPinInterrupts())(void)
+{
+	static thread_local void (*Interrupts[HostPinCount])(void) = {};
+	return Interrupts;
+}
+
+inline uint32_t micros()
+{
+	return HostMicros();
+}
+
+inline uint32_t millis()
+{
+	return HostMicros() / 1000;
+}
+
+inline void noInterrupts() {}
+
+inline void interrupts() {}
+
+inline void pinMode(const uint8_t pin, const uint8_t mode) {}
+
+inline void digitalWrite(const uint8_t pin, const uint8_t value)
+{
+	if (HostPinListener() != nullptr)
+	{
+		HostPinListener()(pin, value);
+	}
+}
+
+inline uint8_t digitalPinToInterrupt(const uint8_t pin)
+{
+	return pin;
+}
+
+inline void attachInterrupt(const uint8_t interruptNumber, void (*callback)(void), const int mode)
+{
+	if (interruptNumber < HostPinCount)
+	{
+		HostPinInterrupts()[interruptNumber] = callback;
+	}
+}
+
+inline void detachInterrupt(const uint8_t interruptNumber)
+{
+	if (interruptNumber < HostPinCount)
+	{
+		HostPinInterrupts()[interruptNumber] = nullptr;
+	}
+}
+
+// Raises a pin interrupt at the current simulated time, if attached.
+inline void HostRaisePin(const uint8_t pin)
+{
+	if (pin < HostPinCount && HostPinInterrupts()[pin] != nullptr)
+	{
+		HostPinInterrupts()[pin]();
+	}
+}
+#endif
@@ -0,0 +1,109 @@
+// TaskSchedulerDeclarations.h
+// Minimal Task Scheduler stand-in, for building PulsePacketTaskDriver on a host computer.
+// Only the object oriented callback flavor (_TASK_OO_CALLBACKS) is provided.
+// Scheduler::execute() runs each enabled task once per pass, once its delay has passed.
+// Delays are in millis, or micros with _TASK_MICRO_RES, against the simulated time.
+//
+// Build with -DPIM_HOST -I extras/Host -I src
+
+#ifndef _HOST_TASK_SCHEDULER_DECLARATIONS_h
+#define _HOST_TASK_SCHEDULER_DECLARATIONS_h
+
+#include <Arduino.h>
+
+#define TASK_FOREVER (-1)
+#define TASK_IMMEDIATE 0
+
+class Task;
+
+class Scheduler
+{
+private:
+	static const uint8_t MaxTasks = 16;
+
+	Task* Tasks[MaxTasks] = {};
+	uint8_t TaskCount = 0;
+
+public:
+	void addTask(Task& task)
+	{
+		if (TaskCount < MaxTasks)
+		{
+			Tasks[TaskCount++] = &task;
+		}
+	}
+
+	// Returns true if no task was run.
+	inline bool execute();
+};
+
+#if defined(_TASK_MICRO_RES)
+static const uint32_t HostTaskTimeMicros = 1;
+#else
+static const uint32_t HostTaskTimeMicros = 1000;
+#endif
+
+class Task
+{
+private:
+	bool Enabled = false;
+	uint32_t RunAfter = 0;
+
+public:
+	Task(const unsigned long interval, const long iterations, Scheduler* scheduler, const bool enable)
+		: Enabled(enable)
+	{
+		if (scheduler != nullptr)
+		{
+			scheduler->addTask(*this);
+		}
+	}
+
+	virtual ~Task() {}
+
+	void enable()
+	{
+		Enabled = true;
+		RunAfter = micros();
+	}
+
+	void enableDelayed(const unsigned long delay)
+	{
+		Enabled = true;
+		RunAfter = micros() + (delay * HostTaskTimeMicros);
+	}
+
+	void disable()
+	{
+		Enabled = false;
+	}
+
+	bool isEnabled()
+	{
+		return Enabled;
+	}
+
+	bool isDue()
+	{
+		return (int32_t)(micros() - RunAfter) >= 0;
+	}
+
+	virtual bool Callback() = 0;
+};
+
+bool Scheduler::execute()
+{
+	bool idle = true;
+	for (uint8_t i = 0; i < TaskCount; i++)
+	{
+		if (Tasks[i]->isEnabled()
+			&& Tasks[i]->isDue())
+		{
+			Tasks[i]->Callback();
+			idle = false;
+		}
+	}
+
+	return idle;
+}
+#endif
\ No newline at end of file
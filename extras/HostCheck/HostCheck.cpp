@@ -0,0 +1,589 @@
+// HostCheck.cpp
+// Host checks of the writer against the mock timer, run after changes to the writer or the timer backends.
+// Each packet's recorded compare sequence must be exactly the protocol's intervals for its bits,
+// with no violations, and the mock must catch a preamble in the middle of a packet.
+// With PIM_STREAMING, a producer slower than the interrupt must not move any pulse.
+// A reply sent from the driver's OnDriverPacketReceived() must keep the reader blanked until it's out.
+// The send queue must pick packets in order, across the push order wrap and a freed head slot.
+// With PIM_SEND_SCHEDULER, by priority, then earliest deadline across the micros() wrap, then without one,
+// and expiring packets must never take the one being sent.
+// PulseTimeSync must hold network time within 20 us on a skewed, jittery receiver clock, also after a master reset.
+// Prints one line per check and exits with 1 if any fails.
+//
+// g++ -O2 -std=c++11 -DPIM_HOST -I extras/Host -I src extras/HostCheck/HostCheck.cpp src/PulseIntervalModulator/PacketWriter.cpp -o HostCheck
+// Link options are compile time, build with -DPIM_FEC, -DPIM_EXTENDED_HEADER, -DPIM_RATE_SWITCHING, -DPIM_STREAMING
+// or -DPIM_SEND_SCHEDULER to check them too.
+//
+// Usage:
+// HostCheck [options]
+//	--seed <n>			Random seed, default 1.
+
+#include <PulsePacketTaskDriver.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static const uint8_t WritePin = 7;
+
+class CheckWriterHandler : public PacketWriterHandler
+{
+public:
+	bool Sent = false;
+
+	// Called from the writer interrupt, once.
+	void (*OnSent)(void) = nullptr;
+
+	// Stream source, each byte takes ProducerMicros of simulated time.
+	const uint8_t* StreamData = nullptr;
+	uint32_t ProducerMicros = 0;
+
+	const uint8_t GetStreamByte(const PacketSizeType byteIndex)
+	{
+		HostMicros() += ProducerMicros;
+
+		return StreamData[byteIndex];
+	}
+
+	void OnPacketSent()
+	{
+		Sent = true;
+		if (OnSent != nullptr)
+		{
+			void (*onSent)(void) = OnSent;
+			OnSent = nullptr;
+			onSent();
+		}
+	}
+};
+
+static TemplatePacketWriter<CheckWriterHandler> Writer(CheckWriterHandler(), Constants::MaxDataBytes, WritePin);
+
+static uint32_t Failures = 0;
+
+static void Report(const char* name, const bool passed, const char* detail)
+{
+	printf("%s,%s,%s\n", name, passed ? "pass" : "FAIL", detail);
+	if (!passed)
+	{
+		Failures++;
+	}
+}
+
+static void AddBits(std::vector<uint32_t>& sequence, const uint16_t value, const uint8_t bits)
+{
+	for (uint8_t i = 0; i < bits; i++)
+	{
+		const uint32_t interval = ((value >> (bits - 1 - i)) & 0x01) ? Constants::OneInterval : Constants::ZeroInterval;
+		sequence.push_back(interval);
+	}
+}
+
+// Intervals after the start pulse, from the protocol description, base rate.
+static std::vector<uint32_t> GetExpectedSequence(const uint8_t* data, const PacketSizeType size)
+{
+	const uint32_t preamble = Constants::PreambleInterval;
+	std::vector<uint32_t> sequence;
+	sequence.push_back(preamble);
+
+	uint16_t headerValue = size - Constants::MinDataBytes;
+	std::vector<uint8_t> groups;
+#if defined(PIM_EXTENDED_HEADER)
+	if (size >= Constants::ExtendedBaseBytes)
+	{
+		headerValue = Constants::HeaderEscape;
+		PacketSizeType extendedSize = size - Constants::ExtendedBaseBytes;
+		do
+		{
+			groups.insert(groups.begin(), (uint8_t)((extendedSize & 0x7F) | (groups.empty() ? 0 : 0x80)));
+			extendedSize >>= Constants::ExtendedGroupBits;
+		} while (extendedSize > 0);
+	}
+#endif
+	headerValue <<= Constants::RateBits;
+	AddBits(sequence, headerValue, Constants::HeaderFieldBits);
+
+	for (uint8_t group : groups)
+	{
+		AddBits(sequence, group, 8);
+	}
+
+	for (PacketSizeType i = 0; i < size; i++)
+	{
+#if defined(PIM_FEC)
+		AddBits(sequence, HammingCode::Encode(data[i]), Constants::DataWordBits);
+#else
+		AddBits(sequence, data[i], Constants::DataWordBits);
+#endif
+	}
+
+	return sequence;
+}
+
+// Fires the mock timer at its deadlines until the writer detaches, returns the pulses out.
+template<typename WriterType>
+static uint32_t RunWriter(WriterType& writer)
+{
+	InterruptTimerWrapper& timer = writer.GetTimerWrapper();
+	uint32_t fired = 0;
+	while (timer.IsArmed())
+	{
+		HostMicros() = timer.GetDeadline();
+		timer.Fire();
+		fired++;
+	}
+	HostMicros() += Constants::SendSilenceInterval + 1;
+
+	return fired;
+}
+
+static void CheckSequences(std::mt19937& random)
+{
+	std::vector<PacketSizeType> sizes = { Constants::MinDataBytes, 2, 17, Constants::MaxDataBytes };
+#if defined(PIM_EXTENDED_HEADER)
+	sizes.push_back(Constants::ExtendedBaseBytes - 1);
+	sizes.push_back(Constants::ExtendedBaseBytes);
+	sizes.push_back(Constants::ExtendedBaseBytes + 200);
+#endif
+
+	std::vector<uint8_t> payload(Constants::MaxDataBytes);
+	for (PacketSizeType size : sizes)
+	{
+		for (PacketSizeType i = 0; i < size; i++)
+		{
+			payload[i] = (uint8_t)random();
+		}
+
+		InterruptTimerWrapper& timer = Writer.GetTimerWrapper();
+		const uint32_t violationsBefore = timer.GetViolations();
+		Writer.GetHandler().Sent = false;
+		Writer.SendPacket(payload.data(), size);
+		RunWriter(Writer);
+
+		const std::vector<uint32_t> expected = GetExpectedSequence(payload.data(), size);
+		const bool matches = timer.GetSequenceLength() == expected.size()
+			&& memcmp(timer.GetSequence(), expected.data(), expected.size() * sizeof(uint32_t)) == 0;
+		const uint32_t violations = timer.GetViolations() - violationsBefore;
+
+		char name[48];
+		char detail[96];
+		snprintf(name, sizeof(name), "writer.sequence.%u", (unsigned)size);
+		snprintf(detail, sizeof(detail), "intervals %u/%u violations %lu sent %d",
+			(unsigned)timer.GetSequenceLength(), (unsigned)expected.size(), (unsigned long)violations,
+			Writer.GetHandler().Sent ? 1 : 0);
+		Report(name, matches && violations == 0 && Writer.GetHandler().Sent, detail);
+	}
+}
+
+// A packet started over another one, without Stop(), is a preamble in the middle of a sequence.
+static void CheckMidSequencePreamble()
+{
+	uint8_t payload[4] = { 0x12, 0x34, 0x56, 0x78 };
+	InterruptTimerWrapper& timer = Writer.GetTimerWrapper();
+	const uint32_t violationsBefore = timer.GetViolations();
+
+	Writer.SendPacket(payload, sizeof(payload));
+	for (uint8_t i = 0; i < 5 && timer.IsArmed(); i++)
+	{
+		HostMicros() = timer.GetDeadline();
+		timer.Fire();
+	}
+	Writer.SendPacket(payload, sizeof(payload));
+	RunWriter(Writer);
+
+	char detail[48];
+	snprintf(detail, sizeof(detail), "violations %lu", (unsigned long)(timer.GetViolations() - violationsBefore));
+	Report("timer.preamble_mid_sequence", timer.GetViolations() - violationsBefore == 1, detail);
+}
+
+static uint8_t ResendPayload[3] = { 0xA5, 0x5A, 0xFF };
+
+static void Resend()
+{
+	Writer.SendPacket(ResendPayload, sizeof(ResendPayload));
+}
+
+// Same from the last pulse's interrupt, where the mock timer isn't armed.
+static void CheckInterruptPreamble()
+{
+	InterruptTimerWrapper& timer = Writer.GetTimerWrapper();
+	const uint32_t violationsBefore = timer.GetViolations();
+
+	Writer.GetHandler().OnSent = Resend;
+	Writer.SendPacket(ResendPayload, sizeof(ResendPayload));
+	RunWriter(Writer);
+	Writer.Stop();
+
+	char detail[48];
+	snprintf(detail, sizeof(detail), "violations %lu", (unsigned long)(timer.GetViolations() - violationsBefore));
+	Report("timer.preamble_in_interrupt", timer.GetViolations() - violationsBefore == 1, detail);
+}
+
+#if defined(PIM_STREAMING)
+static std::vector<uint32_t> PulseTimes;
+
+static void OnPin(const uint8_t pin, const uint8_t value)
+{
+	if (pin == WritePin && value == HIGH)
+	{
+		PulseTimes.push_back(HostMicros());
+	}
+}
+
+// The timer schedules from the counter, as on AVR: the writer must set the next compare
+// before asking the producer, or a slow one stretches the first interval of each byte.
+static void CheckSlowProducer(std::mt19937& random)
+{
+	std::vector<uint8_t> payload(17);
+	for (uint8_t& value : payload)
+	{
+		value = (uint8_t)random();
+	}
+	const PacketSizeType size = (PacketSizeType)payload.size();
+
+	CheckWriterHandler& handler = Writer.GetHandler();
+	handler.StreamData = payload.data();
+	handler.ProducerMicros = Constants::ZeroInterval / 2;
+	PulseTimes.clear();
+	HostPinListener() = OnPin;
+
+	Writer.SendStream(size);
+	RunWriter(Writer);
+
+	HostPinListener() = nullptr;
+	handler.ProducerMicros = 0;
+
+	std::vector<uint32_t> intervals;
+	for (size_t i = 1; i < PulseTimes.size(); i++)
+	{
+		intervals.push_back(PulseTimes[i] - PulseTimes[i - 1]);
+	}
+
+	const std::vector<uint32_t> expected = GetExpectedSequence(payload.data(), size);
+	const bool matches = intervals == expected;
+	uint32_t stretched = 0;
+	for (size_t i = 0; i < intervals.size() && i < expected.size(); i++)
+	{
+		stretched += (intervals[i] != expected[i]) ? 1 : 0;
+	}
+
+	char detail[64];
+	snprintf(detail, sizeof(detail), "intervals %u/%u stretched %lu",
+		(unsigned)intervals.size(), (unsigned)expected.size(), (unsigned long)stretched);
+	Report("writer.slow_producer", matches, detail);
+}
+#endif
+
+static const uint8_t DriverReadPin = 3;
+static const uint8_t DriverWritePin = 8;
+
+// Request and response node, replies from the receive handler.
+class ReplyDriver : public PulsePacketTaskDriver<16>
+{
+public:
+	uint8_t Received = 0;
+	uint8_t Replies = 0;
+
+	ReplyDriver(Scheduler* scheduler)
+		: PulsePacketTaskDriver<16>(scheduler, DriverReadPin, DriverWritePin)
+	{}
+
+protected:
+	void OnDriverPacketReceived(const uint32_t startTimestamp, const PacketSizeType packetSize) override
+	{
+		Received++;
+
+		uint8_t reply[2] = { IncomingPacket[0], 0xA5 };
+		if (CanSend())
+		{
+			SendPacket(reply, sizeof(reply));
+			Replies++;
+		}
+	}
+};
+
+// Pulses a packet into the pin, then waits out the receive silence.
+static void FeedPacket(const uint8_t pin, const uint8_t* data, const PacketSizeType size)
+{
+	HostRaisePin(pin);
+	for (const uint32_t interval : GetExpectedSequence(data, size))
+	{
+		HostMicros() += interval;
+		HostRaisePin(pin);
+	}
+	HostMicros() += Constants::ReceiveSilenceInterval + 1;
+}
+
+static void CheckSendFromHandler()
+{
+	Scheduler scheduler;
+	ReplyDriver driver(&scheduler);
+	driver.Start();
+
+	const uint8_t request[3] = { 0x01, 0x02, 0x03 };
+	FeedPacket(DriverReadPin, request, sizeof(request));
+	driver.Callback();
+
+	// Reply on the line: nothing else may start and the reader must not listen.
+	const bool sending = driver.GetWriter().GetTimerWrapper().IsArmed();
+	const bool blanked = driver.GetReader().IsBlanking() && !driver.CanSend();
+
+	RunWriter(driver.GetWriter());
+	driver.Callback();
+	const bool restored = !driver.GetReader().IsBlanking();
+
+	// Listening again, the next request is received.
+	FeedPacket(DriverReadPin, request, sizeof(request));
+	driver.Callback();
+	RunWriter(driver.GetWriter());
+	driver.Callback();
+	driver.Stop();
+
+	char detail[96];
+	snprintf(detail, sizeof(detail), "sending %d blanked %d restored %d received %u replies %u",
+		sending ? 1 : 0, blanked ? 1 : 0, restored ? 1 : 0, (unsigned)driver.Received, (unsigned)driver.Replies);
+	Report("driver.send_from_handler", sending && blanked && restored && driver.Received == 2 && driver.Replies == 2, detail);
+}
+
+// Deepest queue the push order wrap holds for.
+typedef PulseSendQueue<2, 127> CheckQueue;
+
+// Packets are told apart by their 16 bit id.
+static const bool PushId(CheckQueue& queue, const uint16_t id,
+	const uint8_t priority = 0, const uint32_t deadline = 0, const uint32_t now = 0)
+{
+	const uint8_t data[2] = { (uint8_t)id, (uint8_t)(id >> 8) };
+#if defined(PIM_SEND_SCHEDULER)
+	return queue.Push(data, sizeof(data), priority, deadline, now);
+#else
+	return queue.Push(data, sizeof(data));
+#endif
+}
+
+static const uint16_t PeekId(CheckQueue& queue)
+{
+	const uint8_t* data = queue.PeekData();
+
+	return (uint16_t)data[0] | ((uint16_t)data[1] << 8);
+}
+
+// Ids pushed, in order of selection. Selects and pops them all, detail lists the ids selected.
+static const bool IsSelectOrder(CheckQueue& queue, const uint16_t* ids, const uint8_t count, char* detail, const size_t detailSize)
+{
+	bool inOrder = queue.GetCount() == count;
+	size_t length = snprintf(detail, detailSize, "selected");
+	while (!queue.IsEmpty())
+	{
+		queue.Select();
+		const uint16_t id = PeekId(queue);
+		queue.Pop();
+
+		inOrder = inOrder && id == ids[count - 1 - queue.GetCount()];
+		if (length < detailSize)
+		{
+			length += snprintf(detail + length, detailSize - length, " %u", (unsigned)id);
+		}
+	}
+
+	return inOrder;
+}
+
+static void CheckSendQueue()
+{
+	// Full queue, oldest out and a new one in, for over four wraps of the push order.
+	{
+		CheckQueue queue;
+		uint16_t nextId = 0;
+		while (PushId(queue, nextId))
+		{
+			nextId++;
+		}
+
+		uint16_t expected = 0;
+		bool inOrder = nextId == 127;
+		for (uint16_t i = 0; i < 1024 && inOrder; i++)
+		{
+			queue.Select();
+			inOrder = PeekId(queue) == expected++;
+			queue.Pop();
+			inOrder = inOrder && PushId(queue, nextId++);
+		}
+
+		char detail[48];
+		snprintf(detail, sizeof(detail), "selected %u", (unsigned)expected);
+		Report("queue.order_wrap", inOrder, detail);
+	}
+
+	// The new packet takes the freed head slot, the older one must still go first.
+	{
+		CheckQueue queue;
+		PushId(queue, 1);
+		PushId(queue, 2);
+		queue.Select();
+		queue.Pop();
+		PushId(queue, 3);
+
+		const uint16_t ids[] = { 2, 3 };
+		char detail[48];
+		Report("queue.pop_then_select", IsSelectOrder(queue, ids, 2, detail, sizeof(detail)), detail);
+	}
+
+#if defined(PIM_SEND_SCHEDULER)
+	// An urgent deadline doesn't beat a more urgent class.
+	{
+		CheckQueue queue;
+		PushId(queue, 1, 1, 10, 0);
+		PushId(queue, 2, 0, 0, 0);
+
+		const uint16_t ids[] = { 2, 1 };
+		char detail[48];
+		Report("queue.priority_before_deadline", IsSelectOrder(queue, ids, 2, detail, sizeof(detail)), detail);
+	}
+
+	// Deadline of 2 wraps past 0, it's still after 1's, pushed both ways round.
+	{
+		const uint32_t now = UINT32_MAX - 0xFF;
+		CheckQueue queue;
+		PushId(queue, 2, 0, 0x200, now);
+		PushId(queue, 1, 0, 0x80, now);
+		PushId(queue, 3, 0, 0x300, now);
+
+		CheckQueue reversed;
+		PushId(reversed, 1, 0, 0x80, now);
+		PushId(reversed, 3, 0, 0x300, now);
+		PushId(reversed, 2, 0, 0x200, now);
+
+		const uint16_t ids[] = { 1, 2, 3 };
+		char detail[48];
+		char reversedDetail[48];
+		const bool inOrder = IsSelectOrder(queue, ids, 3, detail, sizeof(detail));
+		const bool reversedInOrder = IsSelectOrder(reversed, ids, 3, reversedDetail, sizeof(reversedDetail));
+		Report("queue.deadline_wrap", inOrder && reversedInOrder, inOrder ? reversedDetail : detail);
+	}
+
+	// Without a deadline goes after any deadline, however far, then in push order.
+	{
+		CheckQueue queue;
+		PushId(queue, 3, 0, 0, 0);
+		PushId(queue, 4, 0, 0, 0);
+		PushId(queue, 2, 0, INT32_MAX, 0);
+		PushId(queue, 1, 0, 100, 0);
+
+		const uint16_t ids[] = { 1, 2, 3, 4 };
+		char detail[48];
+		Report("queue.no_deadline_last", IsSelectOrder(queue, ids, 4, detail, sizeof(detail)), detail);
+	}
+
+	// The selected packet is on the line, it must survive its own deadline.
+	{
+		CheckQueue queue;
+		PushId(queue, 1, 0, 10, 0);
+		PushId(queue, 2, 0, 10, 0);
+		queue.Select();
+
+		uint8_t priority = 0;
+		const bool expiredOther = queue.PopExpired(100, true, priority);
+		const bool expiredMore = queue.PopExpired(100, true, priority);
+		const bool headKept = queue.GetCount() == 1 && PeekId(queue) == 1;
+		const bool expiredHead = queue.PopExpired(100, false, priority);
+
+		char detail[64];
+		snprintf(detail, sizeof(detail), "other %d more %d kept %d head %d",
+			expiredOther ? 1 : 0, expiredMore ? 1 : 0, headKept ? 1 : 0, expiredHead ? 1 : 0);
+		Report("queue.expire_keeps_head", expiredOther && !expiredMore && headKept && expiredHead && queue.IsEmpty(), detail);
+	}
+#endif
+}
+
+// Receiver clock 80 ppm fast with 2 us of jitter on its timestamps, a beacon every second.
+// Network time is probed half way between beacons, once settled, before and after the master resets
+// and its clock jumps. The network clock starts close to the 32 bit roll-over.
+static void CheckTimeSync(std::mt19937& random)
+{
+	static const double Skew = 80e-6;
+	static const double JitterMicros = 2;
+	static const uint32_t BeaconMicros = 1000000;
+	static const uint32_t Beacons = 120;
+	static const uint32_t ResetBeacon = 60;
+	static const uint32_t SettleBeacons = 20;
+	static const uint32_t StepMicros = 50000;
+	static const int32_t MaxErrorMicros = 20;
+
+	PulseTimeSync<> master;
+	PulseTimeSync<> receiver;
+	std::normal_distribution<double> jitter(0, JitterMicros);
+	uint8_t beacon[PulseTimeSync<>::BeaconSize];
+
+	uint32_t networkStart = UINT32_MAX - (10 * BeaconMicros);
+	const uint32_t localStart = 123456789;
+	int32_t maxError[2] = { 0, 0 };
+	bool synced[2] = { true, true };
+
+	for (uint32_t i = 0; i < Beacons; i++)
+	{
+		if (i == ResetBeacon)
+		{
+			master = PulseTimeSync<>();
+			networkStart += StepMicros;
+		}
+
+		const double elapsed = (double)i * BeaconMicros;
+		const uint32_t network = networkStart + (uint32_t)elapsed;
+		const uint32_t local = localStart + (uint32_t)llround(elapsed * (1 + Skew));
+
+		master.WriteBeacon(beacon);
+		receiver.OnBeaconReceived(beacon, local + Constants::TimeSyncLatency + (int32_t)lround(jitter(random)));
+		master.OnBeaconSent(network);
+
+		const uint8_t phase = (i < ResetBeacon) ? 0 : 1;
+		if (i >= (phase * ResetBeacon) + SettleBeacons)
+		{
+			const double probe = elapsed + (BeaconMicros / 2);
+			const uint32_t probeLocal = localStart + (uint32_t)llround(probe * (1 + Skew));
+			const int32_t error = (int32_t)(receiver.ToNetworkMicros(probeLocal) - (networkStart + (uint32_t)probe));
+
+			maxError[phase] = std::max(maxError[phase], std::abs(error));
+			synced[phase] = synced[phase] && receiver.IsSynced();
+		}
+	}
+
+	char detail[64];
+	snprintf(detail, sizeof(detail), "max_error_us %ld synced %d", (long)maxError[0], synced[0] ? 1 : 0);
+	Report("timesync.converge", synced[0] && maxError[0] <= MaxErrorMicros, detail);
+	snprintf(detail, sizeof(detail), "max_error_us %ld synced %d", (long)maxError[1], synced[1] ? 1 : 0);
+	Report("timesync.master_reset", synced[1] && maxError[1] <= MaxErrorMicros, detail);
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t seed = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc)
+		{
+			const char* value = argv[++i];
+			if (strcmp(argv[i - 1], "--seed") == 0) seed = (uint32_t)atol(value);
+		}
+	}
+
+	std::mt19937 random(seed);
+	HostMicros() = 1000;
+	Writer.Start();
+
+	printf("check,result,detail\n");
+	CheckSequences(random);
+	CheckMidSequencePreamble();
+	CheckInterruptPreamble();
+#if defined(PIM_STREAMING)
+	CheckSlowProducer(random);
+#endif
+	CheckSendFromHandler();
+	CheckSendQueue();
+	CheckTimeSync(random);
+
+	return (Failures > 0) ? 1 : 0;
+}
\ No newline at end of file
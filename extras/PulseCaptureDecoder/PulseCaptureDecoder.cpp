@@ -0,0 +1,505 @@
+// PulseCaptureDecoder.cpp
+// Offline decoder for logic analyzer captures.
+// Streams rising edges from a VCD or CSV capture through the library's PacketReader,
+// and reports packets, losses and a rejection breakdown by reason.
+// Memory use is bounded, regardless of the capture size.
+// Each edge goes straight to the reader, the interval histogram is only a summary.
+//
+// Build:
+// g++ -O2 -std=c++11 -DPIM_HOST -I extras/Host -I src extras/PulseCaptureDecoder/PulseCaptureDecoder.cpp -o PulseCaptureDecoder
+//
+// Usage:
+// PulseCaptureDecoder [options] capture.(vcd|csv)
+//	--vcd / --csv		Capture format, default from the file extension.
+//	--signal <name>		VCD signal to decode, default is the first 1 bit signal.
+//	--column <n>		CSV column to decode, default 1 (column 0 is time).
+//	--unit <s|ms|us|ns>	CSV time unit, default s.
+//	--quiet				Only print the summary.
+//
+// CSV rows are "time,level[,level...]", a non-numeric header row is skipped.
+
+#define PIM_READER_STATS
+#define PIM_SILENCE_TIMEOUT
+
+#include <PulseIntervalModulator/PacketReader.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+class CaptureDecoder
+{
+public:
+	enum IntervalClass
+	{
+		Short,
+		Zero,
+		One,
+		Preamble,
+		Long,
+		IntervalClassCount
+	};
+
+private:
+	class DecoderHandler : public PacketReaderHandler
+	{
+	private:
+		CaptureDecoder* Decoder;
+
+	public:
+		DecoderHandler(CaptureDecoder* decoder) : Decoder(decoder) {}
+
+		void OnPacketReceived(const uint32_t startTimestamp)
+		{
+			Decoder->PendingTimestamp = startTimestamp;
+			Decoder->PendingPacket = true;
+		}
+
+		void OnPacketLost(const uint32_t startTimestamp)
+		{
+			Decoder->OnPacketLost(startTimestamp);
+		}
+	};
+
+	uint8_t IncomingBuffer[Constants::MaxDataBytes];
+	TemplatePacketReader<DecoderHandler> Reader;
+
+	// In micro-seconds.
+	uint32_t PreviousEdge = 0;
+	bool HasPreviousEdge = false;
+
+	bool PendingPacket = false;
+	uint32_t PendingTimestamp = 0;
+
+	const bool Quiet;
+
+public:
+	uint64_t TotalEdges = 0;
+	uint64_t TotalLost = 0;
+	uint64_t IntervalHistogram[IntervalClassCount];
+
+public:
+	CaptureDecoder(const bool quiet)
+		: Reader(DecoderHandler(this), IncomingBuffer, Constants::MaxDataBytes, 0)
+		, Quiet(quiet)
+	{
+		memset(IntervalHistogram, 0, sizeof(IntervalHistogram));
+		Reader.Start();
+	}
+
+	void AddEdge(const uint64_t timestampNanos)
+	{
+		const uint32_t edge = (uint32_t)(timestampNanos / 1000);
+		if (HasPreviousEdge)
+		{
+			Classify(edge - PreviousEdge);
+		}
+		PreviousEdge = edge;
+		HasPreviousEdge = true;
+
+		HostMicros() = edge;
+
+		// Truncated packets are reported at the silence, not at the next pulse.
+		Reader.CheckTimeout();
+		Reader.OnPulse();
+
+		if (PendingPacket)
+		{
+			PendingPacket = false;
+			OnPacketReceived();
+		}
+
+		TotalEdges++;
+	}
+
+	void GetStats(PacketReaderStats& stats)
+	{
+		Reader.GetStats(stats);
+	}
+
+private:
+	// Same bounds as the reader.
+	// Windows may overlap, an interval can count in more than one class.
+	void Classify(const uint32_t interval)
+	{
+		IntervalHistogram[Short] += interval <= Constants::ZeroIntervalMin;
+		IntervalHistogram[Zero] += (interval > Constants::ZeroIntervalMin) && (interval <= Constants::OneIntervalMin);
+		IntervalHistogram[One] += (interval > Constants::OneIntervalMin) && (interval < Constants::OneIntervalMax);
+		IntervalHistogram[Preamble] += (interval > Constants::PreambleIntervalMin) && (interval < Constants::PreambleIntervalMax);
+		IntervalHistogram[Long] += interval >= Constants::PreambleIntervalMax;
+	}
+
+	void OnPacketReceived()
+	{
+		PacketSizeType size = 0;
+		if (Reader.HasIncoming(size) && !Quiet)
+		{
+			printf("RX,%lu,%u,", (unsigned long)PendingTimestamp, (unsigned)size);
+			for (PacketSizeType i = 0; i < size; i++)
+			{
+				printf("%02X", IncomingBuffer[i]);
+			}
+			printf("\n");
+		}
+
+		// Buffer is free right away, offline.
+		Reader.Restore();
+	}
+
+	void OnPacketLost(const uint32_t startTimestamp)
+	{
+		TotalLost++;
+		if (!Quiet)
+		{
+			printf("LOST,%lu\n", (unsigned long)startTimestamp);
+		}
+	}
+};
+
+// Buffered line reader, bounded memory.
+class LineStream
+{
+private:
+	static const size_t BufferSize = 1 << 20;
+
+	FILE* File;
+	char* Buffer;
+	size_t Start = 0;
+	size_t End = 0;
+	bool Eof = false;
+
+public:
+	LineStream(FILE* file)
+		: File(file)
+		, Buffer((char*)malloc(BufferSize + 1))
+	{
+	}
+
+	~LineStream()
+	{
+		free(Buffer);
+	}
+
+	// Returns a null terminated line, without the line break.
+	char* NextLine()
+	{
+		while (true)
+		{
+			char* newLine = (char*)memchr(Buffer + Start, '\n', End - Start);
+			if (newLine != nullptr)
+			{
+				char* line = Buffer + Start;
+				*newLine = 0;
+				if (newLine > line && newLine[-1] == '\r')
+				{
+					newLine[-1] = 0;
+				}
+				Start = (newLine - Buffer) + 1;
+				return line;
+			}
+
+			if (Eof)
+			{
+				if (Start < End)
+				{
+					// Last line without line break.
+					char* line = Buffer + Start;
+					Buffer[End] = 0;
+					Start = End;
+					return line;
+				}
+				return nullptr;
+			}
+
+			// Keep the partial line and refill.
+			memmove(Buffer, Buffer + Start, End - Start);
+			End -= Start;
+			Start = 0;
+			if (End >= BufferSize)
+			{
+				// Line too long, drop it.
+				End = 0;
+			}
+			const size_t count = fread(Buffer + End, 1, BufferSize - End, File);
+			End += count;
+			Eof = count == 0;
+		}
+	}
+};
+
+// Returns 0 if there is no timescale value in the text.
+static double ParseTimescaleNanos(const char* text)
+{
+	char* unit = nullptr;
+	const double value = strtod(text, &unit);
+	if (unit == text)
+	{
+		return 0;
+	}
+
+	while (*unit == ' ' || *unit == '\t')
+	{
+		unit++;
+	}
+
+	if (strncmp(unit, "fs", 2) == 0) return value * 1e-6;
+	if (strncmp(unit, "ps", 2) == 0) return value * 1e-3;
+	if (strncmp(unit, "ns", 2) == 0) return value;
+	if (strncmp(unit, "us", 2) == 0) return value * 1e3;
+	if (strncmp(unit, "ms", 2) == 0) return value * 1e6;
+	if (strncmp(unit, "s", 1) == 0) return value * 1e9;
+
+	return value;
+}
+
+static bool DecodeVcd(LineStream& stream, CaptureDecoder& decoder, const char* signalName)
+{
+	char signalId[32] = { 0 };
+	double timescaleNanos = 1;
+	bool inHeader = true;
+	bool inTimescale = false;
+	uint64_t time = 0;
+	int level = -1;
+
+	char* line;
+	while ((line = stream.NextLine()) != nullptr)
+	{
+		if (inHeader)
+		{
+			if (inTimescale || strstr(line, "$timescale") != nullptr)
+			{
+				// Value may be on the same line or on the next ones.
+				const char* text = strstr(line, "$timescale");
+				text = (text != nullptr) ? text + 10 : line;
+
+				const double nanos = ParseTimescaleNanos(text);
+				if (nanos > 0)
+				{
+					timescaleNanos = nanos;
+				}
+				inTimescale = strstr(line, "$end") == nullptr;
+			}
+			else if (strncmp(line, "$var", 4) == 0)
+			{
+				// $var wire 1 <id> <name> $end
+				char type[32], id[32], name[128];
+				int width = 0;
+				if (sscanf(line, "$var %31s %d %31s %127s", type, &width, id, name) == 4
+					&& width == 1
+					&& signalId[0] == 0
+					&& (signalName == nullptr || strcmp(name, signalName) == 0))
+				{
+					strcpy(signalId, id);
+				}
+			}
+			else if (strstr(line, "$enddefinitions") != nullptr)
+			{
+				inHeader = false;
+				if (signalId[0] == 0)
+				{
+					fprintf(stderr, "Signal not found.\n");
+					return false;
+				}
+			}
+			continue;
+		}
+
+		// A time and value changes may share a line, such as "#100 1!".
+		bool skipToken = false;
+		char* token = line;
+		while (*token != 0)
+		{
+			char* end = token;
+			while (*end != 0 && *end != ' ' && *end != '\t')
+			{
+				end++;
+			}
+			const bool last = *end == 0;
+			*end = 0;
+
+			if (skipToken)
+			{
+				skipToken = false;
+			}
+			else switch (token[0])
+			{
+			case '#':
+				time = strtoull(token + 1, nullptr, 10);
+				break;
+			case '0':
+			case '1':
+				if (strcmp(token + 1, signalId) == 0)
+				{
+					const int newLevel = token[0] - '0';
+					if (level == 0 && newLevel == 1)
+					{
+						decoder.AddEdge((uint64_t)(time * timescaleNanos));
+					}
+					level = newLevel;
+				}
+				break;
+			case 'x':
+			case 'X':
+			case 'z':
+			case 'Z':
+				if (strcmp(token + 1, signalId) == 0)
+				{
+					level = -1;
+				}
+				break;
+			case 'b':
+			case 'B':
+			case 'r':
+			case 'R':
+				// Vector or real value, the id is the next token.
+				skipToken = true;
+				break;
+			default:
+				break;
+			}
+
+			token = last ? end : end + 1;
+			while (*token == ' ' || *token == '\t')
+			{
+				token++;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool DecodeCsv(LineStream& stream, CaptureDecoder& decoder, const int column, const double unitNanos)
+{
+	int level = -1;
+
+	char* line;
+	while ((line = stream.NextLine()) != nullptr)
+	{
+		char* end = nullptr;
+		const double time = strtod(line, &end);
+		if (end == line)
+		{
+			// Header or empty row.
+			continue;
+		}
+
+		const char* field = end;
+		for (int i = 0; i < column && field != nullptr; i++)
+		{
+			field = strchr(field, ',');
+			if (field != nullptr)
+			{
+				field++;
+			}
+		}
+		if (field == nullptr)
+		{
+			continue;
+		}
+		while (*field == ' ')
+		{
+			field++;
+		}
+
+		const int newLevel = (*field == '1') ? 1 : 0;
+		if (level == 0 && newLevel == 1)
+		{
+			decoder.AddEdge((uint64_t)(time * unitNanos));
+		}
+		level = newLevel;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = nullptr;
+	const char* signalName = nullptr;
+	int format = 0; // 1 VCD, 2 CSV.
+	int column = 1;
+	double unitNanos = 1e9;
+	bool quiet = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--vcd") == 0) format = 1;
+		else if (strcmp(argv[i], "--csv") == 0) format = 2;
+		else if (strcmp(argv[i], "--quiet") == 0) quiet = true;
+		else if (strcmp(argv[i], "--signal") == 0 && i + 1 < argc) signalName = argv[++i];
+		else if (strcmp(argv[i], "--column") == 0 && i + 1 < argc) column = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--unit") == 0 && i + 1 < argc)
+		{
+			const char* unit = argv[++i];
+			if (strcmp(unit, "ms") == 0) unitNanos = 1e6;
+			else if (strcmp(unit, "us") == 0) unitNanos = 1e3;
+			else if (strcmp(unit, "ns") == 0) unitNanos = 1;
+			else unitNanos = 1e9;
+		}
+		else path = argv[i];
+	}
+
+	if (path == nullptr || column < 1)
+	{
+		fprintf(stderr, "Usage: PulseCaptureDecoder [--vcd|--csv] [--signal name] [--column n] [--unit s|ms|us|ns] [--quiet] capture\n");
+		return 1;
+	}
+
+	if (format == 0)
+	{
+		const size_t length = strlen(path);
+		format = (length > 4 && strcmp(path + length - 4, ".vcd") == 0) ? 1 : 2;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Unable to open %s\n", path);
+		return 1;
+	}
+
+	CaptureDecoder* decoder = new CaptureDecoder(quiet);
+	LineStream stream(file);
+
+	const auto start = std::chrono::steady_clock::now();
+	const bool success = (format == 1)
+		? DecodeVcd(stream, *decoder, signalName)
+		: DecodeCsv(stream, *decoder, column, unitNanos);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fclose(file);
+
+	PacketReaderStats stats;
+	decoder->GetStats(stats);
+
+	printf("# Edges: %llu\n", (unsigned long long)decoder->TotalEdges);
+	printf("# Packets received: %lu\n", (unsigned long)stats.Received);
+	printf("# Packets lost: %llu\n", (unsigned long long)decoder->TotalLost);
+	printf("# Rejections\n");
+	printf("#  Preamble: %lu\n", (unsigned long)stats.PreambleRejects);
+	printf("#  Header bit: %lu\n", (unsigned long)stats.HeaderRejects);
+	printf("#  Header size: %lu\n", (unsigned long)stats.SizeRejects);
+	printf("#  Data bit: %lu\n", (unsigned long)stats.DataRejects);
+	printf("#  Timeout: %lu\n", (unsigned long)stats.Timeouts);
+#if defined(PIM_GLITCH_FILTER)
+	printf("#  Glitch (ignored): %lu\n", (unsigned long)stats.Glitches);
+#endif
+#if defined(PIM_FEC)
+	printf("#  Corrected bits: %lu\n", (unsigned long)stats.CorrectedBits);
+#endif
+#if defined(PIM_RESYNC)
+	printf("#  Resynced: %lu\n", (unsigned long)stats.Resyncs);
+#endif
+	printf("# Intervals (windows may overlap)\n");
+	printf("#  Short: %llu\n", (unsigned long long)decoder->IntervalHistogram[CaptureDecoder::Short]);
+	printf("#  Zero: %llu\n", (unsigned long long)decoder->IntervalHistogram[CaptureDecoder::Zero]);
+	printf("#  One: %llu\n", (unsigned long long)decoder->IntervalHistogram[CaptureDecoder::One]);
+	printf("#  Preamble: %llu\n", (unsigned long long)decoder->IntervalHistogram[CaptureDecoder::Preamble]);
+	printf("#  Long: %llu\n", (unsigned long long)decoder->IntervalHistogram[CaptureDecoder::Long]);
+	printf("# Throughput: %.1f M edges/min\n", seconds > 0 ? (decoder->TotalEdges / seconds) * 60e-6 : 0);
+
+	delete decoder;
+
+	return success ? 0 : 1;
+}
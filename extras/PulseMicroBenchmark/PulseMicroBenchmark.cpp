@@ -0,0 +1,723 @@
+// PulseMicroBenchmark.cpp
+// Host microbenchmarks for the interrupt hot paths, in nanoseconds per call:
+// PacketReader::OnPulse in each state, DecodeBit/ValidatePreamble,
+// PacketWriter::OnWriterInterrupt per bit and PulsePacketTaskDriver::SendPacket.
+// Each benchmark runs with warm caches (back to back calls) and cold caches
+// (data caches evicted before every timed sample).
+// Each run measures in a new process, a process is fast or slow for its whole life,
+// and the fastest run's median is kept: host noise only ever adds time.
+// Results are printed as CSV. Against a baseline (a previous run's output), while any benchmark is
+// slower than the baseline plus the tolerance another run is made, those still slower after the
+// retries fail and the exit code is 1. The cold driver call is printed but not gated.
+//
+// Build:
+// g++ -O2 -std=c++11 -DPIM_HOST -I extras/Host -I src extras/PulseMicroBenchmark/PulseMicroBenchmark.cpp src/PulseIntervalModulator/PacketWriter.cpp -o PulseMicroBenchmark
+//
+// Usage:
+// PulseMicroBenchmark [options]
+//	--baseline <file>	Previous results to compare against.
+//	--tolerance <pct>	Allowed slowdown over the baseline, default 25.
+//	--slack <ns>		Minimum allowed slowdown, for the shortest calls, default 1.
+//	--filter <text>		Only run benchmarks whose name contains text.
+//	--samples <n>		Timed samples per benchmark and run, default 101.
+//	--runs <n>			Runs, default 3.
+//	--retries <n>		Extra runs while a benchmark is over its limit, default 3.
+//
+// Host timings are not AVR cycle counts, but relative changes on the same machine
+// track changes to the interrupt paths.
+
+#include <PulseIntervalModulator.h>
+#include <PulsePacketTaskDriver.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static const uint8_t ReadPin = 2;
+static const uint8_t WritePin = 7;
+static const uint8_t DriverReadPin = 3;
+static const uint8_t DriverWritePin = 8;
+
+// Largest packet of the 6 bit header.
+static const uint8_t PacketSize = 64;
+
+// Sinks to keep results observable.
+static volatile uint32_t Sink = 0;
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+class ReaderProbe : public TemplatePacketReader<PacketReaderHandler>
+{
+public:
+	ReaderProbe(uint8_t* incomingBuffer, const PacketSizeType maxDataBytes)
+		: TemplatePacketReader<PacketReaderHandler>(PacketReaderHandler(), incomingBuffer, maxDataBytes, ::ReadPin)
+	{
+	}
+
+	using TemplatePacketReader<PacketReaderHandler>::DecodeBit;
+	using TemplatePacketReader<PacketReaderHandler>::ValidatePreamble;
+};
+
+class BenchmarkDriver : public PulsePacketTaskDriver<PacketSize>
+{
+public:
+	BenchmarkDriver(Scheduler* scheduler)
+		: PulsePacketTaskDriver<PacketSize>(scheduler, DriverReadPin, DriverWritePin)
+	{
+	}
+};
+
+// A benchmark runs one iteration per call and returns the number of operations it did.
+class Benchmark
+{
+public:
+	virtual ~Benchmark() {}
+	virtual const char* GetName() = 0;
+	virtual uint32_t Run() = 0;
+
+	// Before each timed sample, not timed.
+	virtual void Reset() {}
+
+	// Calls per timed sample between resets.
+	virtual uint32_t GetMaxIterations() { return 1UL << 20; }
+};
+
+// Precomputed pulse intervals, replayed on a running simulated clock.
+class PulseStreamBenchmark : public Benchmark
+{
+protected:
+	std::vector<uint32_t> Intervals;
+	uint32_t Now = 1000;
+
+	template<typename ReaderType>
+	void Replay(ReaderType& reader)
+	{
+		for (size_t i = 0; i < Intervals.size(); i++)
+		{
+			Now += Intervals[i];
+			HostMicros() = Now;
+			reader.OnPulse();
+		}
+	}
+
+	void AddBits(const uint16_t value, const uint8_t bits)
+	{
+		for (uint8_t i = 0; i < bits; i++)
+		{
+			Intervals.push_back(((value >> (bits - 1 - i)) & 0x01) ? (uint32_t)Constants::OneInterval : (uint32_t)Constants::ZeroInterval);
+		}
+	}
+};
+
+// Blanked reader, pulses are ignored.
+class BlankingBenchmark : public PulseStreamBenchmark
+{
+private:
+	uint8_t Buffer[PacketSize];
+	ReaderProbe Reader;
+
+public:
+	BlankingBenchmark() : Reader(Buffer, PacketSize)
+	{
+		Reader.Start();
+		Reader.BlankReceive();
+		Intervals.assign(256, (uint32_t)Constants::ZeroInterval);
+	}
+
+	const char* GetName() { return "reader.blanking"; }
+
+	uint32_t Run()
+	{
+		Replay(Reader);
+		return Intervals.size();
+	}
+};
+
+// WaitingForPreAmbleEnd, every pulse is too close to be a preamble and restarts.
+class PreambleRejectBenchmark : public PulseStreamBenchmark
+{
+private:
+	uint8_t Buffer[PacketSize];
+	ReaderProbe Reader;
+
+public:
+	PreambleRejectBenchmark() : Reader(Buffer, PacketSize)
+	{
+		Reader.Start();
+		Intervals.assign(256, (uint32_t)Constants::ZeroInterval);
+	}
+
+	const char* GetName() { return "reader.preamble_reject"; }
+
+	uint32_t Run()
+	{
+		Replay(Reader);
+		return Intervals.size();
+	}
+};
+
+// WaitingForHeaderEnd: preamble, then a header over the reader's maximum size,
+// whose last pulse becomes the next start pulse.
+class HeaderBenchmark : public PulseStreamBenchmark
+{
+private:
+	uint8_t Buffer[Constants::MinDataBytes];
+	ReaderProbe Reader;
+
+public:
+	HeaderBenchmark() : Reader(Buffer, Constants::MinDataBytes)
+	{
+		Reader.Start();
+		HostMicros() = Now;
+		Reader.OnPulse();
+		for (uint8_t i = 0; i < 32; i++)
+		{
+			Intervals.push_back((uint32_t)Constants::PreambleInterval);
+			AddBits(62 << Constants::RateBits, Constants::HeaderFieldBits);
+		}
+	}
+
+	const char* GetName() { return "reader.header"; }
+
+	uint32_t Run()
+	{
+		Replay(Reader);
+		return Intervals.size();
+	}
+};
+
+// Full packets, dominated by WaitingForDataBits.
+class PacketBenchmark : public PulseStreamBenchmark
+{
+private:
+	uint8_t Buffer[PacketSize];
+	ReaderProbe Reader;
+
+public:
+	PacketBenchmark() : Reader(Buffer, PacketSize)
+	{
+		Reader.Start();
+
+		// Start pulse after the previous packet's silence.
+		Intervals.push_back((uint32_t)Constants::SendSilenceInterval);
+		Intervals.push_back((uint32_t)Constants::PreambleInterval);
+#if defined(PIM_EXTENDED_HEADER)
+		// Escape, then an extended size of 0 for 64 bytes.
+		AddBits(Constants::HeaderEscape << Constants::RateBits, Constants::HeaderFieldBits);
+		AddBits(0, 8);
+#else
+		AddBits((PacketSize - Constants::MinDataBytes) << Constants::RateBits, Constants::HeaderFieldBits);
+#endif
+		for (uint8_t i = 0; i < PacketSize; i++)
+		{
+			const uint8_t value = (uint8_t)((i * 37) + 11);
+#if defined(PIM_FEC)
+			AddBits(HammingCode::Encode(value), HammingCode::CodeBits);
+#else
+			AddBits(value, 8);
+#endif
+		}
+	}
+
+	const char* GetName() { return "reader.packet"; }
+
+	uint32_t Run()
+	{
+		Replay(Reader);
+
+		PacketSizeType size = 0;
+		Sink += Reader.HasIncoming(size) ? size : 0;
+		Reader.Restore();
+
+		return Intervals.size();
+	}
+};
+
+class DecodeBitBenchmark : public Benchmark
+{
+private:
+	uint8_t Buffer[PacketSize];
+	ReaderProbe Reader;
+	uint32_t Separations[256];
+
+public:
+	DecodeBitBenchmark() : Reader(Buffer, PacketSize)
+	{
+		// Mix of zeros, ones and invalid intervals, unpredictable to the branch predictor.
+		uint32_t seed = 12345;
+		for (uint16_t i = 0; i < 256; i++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			Separations[i] = (seed >> 16) % (Constants::OneIntervalMax + Constants::IntervalTolerance);
+		}
+	}
+
+	const char* GetName() { return "reader.decode_bit"; }
+
+	uint32_t Run()
+	{
+		uint32_t count = 0;
+		for (uint16_t i = 0; i < 256; i++)
+		{
+			bool bit = false;
+			count += Reader.DecodeBit(Separations[i], bit) + bit;
+		}
+		Sink += count;
+
+		return 256;
+	}
+};
+
+class ValidatePreambleBenchmark : public Benchmark
+{
+private:
+	uint8_t Buffer[PacketSize];
+	ReaderProbe Reader;
+	uint32_t Durations[256];
+
+public:
+	ValidatePreambleBenchmark() : Reader(Buffer, PacketSize)
+	{
+		uint32_t seed = 54321;
+		for (uint16_t i = 0; i < 256; i++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			Durations[i] = (seed >> 16) % (Constants::PreambleIntervalMax + Constants::IntervalTolerance);
+		}
+	}
+
+	const char* GetName() { return "reader.validate_preamble"; }
+
+	uint32_t Run()
+	{
+		uint32_t count = 0;
+		for (uint16_t i = 0; i < 256; i++)
+		{
+			count += Reader.ValidatePreamble(Durations[i]);
+		}
+		Sink += count;
+
+		return 256;
+	}
+};
+
+// One full packet through the mock timer, per timer interrupt.
+class WriterBitBenchmark : public Benchmark
+{
+private:
+	TemplatePacketWriter<PacketWriterHandler> Writer;
+	uint8_t Data[PacketSize];
+
+public:
+	WriterBitBenchmark() : Writer(PacketWriterHandler(), PacketSize, WritePin)
+	{
+		for (uint8_t i = 0; i < PacketSize; i++)
+		{
+			Data[i] = (uint8_t)((i * 37) + 11);
+		}
+		Writer.Start();
+	}
+
+	const char* GetName() { return "writer.interrupt"; }
+
+	uint32_t Run()
+	{
+		Writer.SendPacket(Data, PacketSize);
+
+		InterruptTimerWrapper& timer = Writer.GetTimerWrapper();
+		uint32_t count = 0;
+		while (timer.IsArmed())
+		{
+			timer.Fire();
+			count++;
+		}
+
+		return count;
+	}
+};
+
+// Each call sends on an idle driver, the drivers are stopped and started again between samples.
+class DriverSendBenchmark : public Benchmark
+{
+private:
+	static const uint8_t DriverCount = 16;
+
+	Scheduler TaskScheduler;
+	BenchmarkDriver* Drivers[DriverCount];
+	uint8_t Data[PacketSize];
+	uint8_t Next = 0;
+
+public:
+	DriverSendBenchmark()
+	{
+		for (uint8_t i = 0; i < DriverCount; i++)
+		{
+			Drivers[i] = new BenchmarkDriver(&TaskScheduler);
+		}
+		for (uint8_t i = 0; i < PacketSize; i++)
+		{
+			Data[i] = i;
+		}
+	}
+
+	~DriverSendBenchmark()
+	{
+		for (uint8_t i = 0; i < DriverCount; i++)
+		{
+			delete Drivers[i];
+		}
+	}
+
+	const char* GetName() { return "driver.send_packet"; }
+
+	uint32_t Run()
+	{
+		Drivers[Next++]->SendPacket(Data, PacketSize);
+
+		return 1;
+	}
+
+	void Reset()
+	{
+		for (uint8_t i = 0; i < Next; i++)
+		{
+			Drivers[i]->Stop();
+			Drivers[i]->Start();
+		}
+		Next = 0;
+	}
+
+	uint32_t GetMaxIterations() { return DriverCount; }
+
+	void Start()
+	{
+		for (uint8_t i = 0; i < DriverCount; i++)
+		{
+			Drivers[i]->Start();
+		}
+	}
+};
+
+class BenchmarkRunner
+{
+private:
+	// Larger than the last level cache on common hosts.
+	static const size_t EvictionSize = 64 * 1024 * 1024;
+
+	std::vector<uint8_t> EvictionBuffer;
+	double ClockOverhead = 0;
+	uint32_t Samples = 101;
+
+public:
+	BenchmarkRunner(const uint32_t samples)
+		: EvictionBuffer(EvictionSize, 1)
+		, Samples(samples)
+	{
+		std::vector<double> overheads;
+		for (uint32_t i = 0; i < 1001; i++)
+		{
+			const BenchmarkClock::time_point start = BenchmarkClock::now();
+			const BenchmarkClock::time_point end = BenchmarkClock::now();
+			overheads.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+		}
+		ClockOverhead = Median(overheads);
+	}
+
+	// Batches back to back calls until a sample is long enough to time reliably.
+	double MeasureWarm(Benchmark& benchmark)
+	{
+		uint32_t iterations = 1;
+		for (;;)
+		{
+			benchmark.Reset();
+			const double elapsed = TimeIterations(benchmark, iterations, nullptr);
+			if (elapsed > 200000 || iterations >= benchmark.GetMaxIterations())
+			{
+				break;
+			}
+			iterations = std::min(iterations * 2, benchmark.GetMaxIterations());
+		}
+
+		std::vector<double> samples;
+		for (uint32_t s = 0; s < Samples; s++)
+		{
+			benchmark.Reset();
+			uint32_t operations = 0;
+			const double elapsed = TimeIterations(benchmark, iterations, &operations) - ClockOverhead;
+			samples.push_back(std::max(elapsed, 0.0) / operations);
+		}
+
+		return Median(samples);
+	}
+
+	// A single call per sample, after evicting the data caches.
+	double MeasureCold(Benchmark& benchmark)
+	{
+		std::vector<double> samples;
+		for (uint32_t s = 0; s < Samples; s++)
+		{
+			benchmark.Reset();
+			Evict();
+			uint32_t operations = 0;
+			const double elapsed = TimeIterations(benchmark, 1, &operations) - ClockOverhead;
+			samples.push_back(std::max(elapsed, 0.0) / operations);
+		}
+
+		return Median(samples);
+	}
+
+private:
+	double TimeIterations(Benchmark& benchmark, const uint32_t iterations, uint32_t* operations)
+	{
+		uint32_t count = 0;
+		const BenchmarkClock::time_point start = BenchmarkClock::now();
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			count += benchmark.Run();
+		}
+		const BenchmarkClock::time_point end = BenchmarkClock::now();
+
+		if (operations != nullptr)
+		{
+			*operations = count;
+		}
+
+		return std::chrono::duration<double, std::nano>(end - start).count();
+	}
+
+	void Evict()
+	{
+		uint32_t sum = 0;
+		for (size_t i = 0; i < EvictionBuffer.size(); i += 64)
+		{
+			EvictionBuffer[i]++;
+			sum += EvictionBuffer[i];
+		}
+		Sink += sum;
+	}
+
+	static double Median(std::vector<double>& values)
+	{
+		std::sort(values.begin(), values.end());
+		return values[values.size() / 2];
+	}
+};
+
+struct BaselineEntry
+{
+	char Name[64];
+	char Cache[8];
+	double NanosPerOp;
+};
+
+static std::vector<BaselineEntry> ReadEntries(FILE* file)
+{
+	std::vector<BaselineEntry> entries;
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		BaselineEntry entry;
+		if (sscanf(line, "%63[^,],%7[^,],%lf", entry.Name, entry.Cache, &entry.NanosPerOp) == 3)
+		{
+			entries.push_back(entry);
+		}
+	}
+
+	return entries;
+}
+
+static std::vector<BaselineEntry> LoadBaseline(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Unable to open baseline %s\n", path);
+		exit(2);
+	}
+
+	std::vector<BaselineEntry> entries = ReadEntries(file);
+	fclose(file);
+
+	return entries;
+}
+
+static const BaselineEntry* FindBaseline(const std::vector<BaselineEntry>& baseline, const char* name, const char* cache)
+{
+	for (size_t i = 0; i < baseline.size(); i++)
+	{
+		if (strcmp(baseline[i].Name, name) == 0 && strcmp(baseline[i].Cache, cache) == 0)
+		{
+			return &baseline[i];
+		}
+	}
+
+	return nullptr;
+}
+
+// Prints each benchmark's results, without gating.
+static void MeasureAll(const uint32_t samples, const char* filter)
+{
+	BlankingBenchmark blanking;
+	PreambleRejectBenchmark preambleReject;
+	HeaderBenchmark header;
+	PacketBenchmark packet;
+	DecodeBitBenchmark decodeBit;
+	ValidatePreambleBenchmark validatePreamble;
+	WriterBitBenchmark writerBit;
+	DriverSendBenchmark driverSend;
+	driverSend.Start();
+
+	Benchmark* benchmarks[] = { &blanking, &preambleReject, &header, &packet,
+		&decodeBit, &validatePreamble, &writerBit, &driverSend };
+
+	BenchmarkRunner runner(samples);
+	for (Benchmark* benchmark : benchmarks)
+	{
+		if (filter == nullptr || strstr(benchmark->GetName(), filter) != nullptr)
+		{
+			printf("%s,warm,%.2f\n", benchmark->GetName(), runner.MeasureWarm(*benchmark));
+			printf("%s,cold,%.2f\n", benchmark->GetName(), runner.MeasureCold(*benchmark));
+		}
+	}
+}
+
+struct BenchmarkResult
+{
+	BaselineEntry Entry;
+	double Limit;
+};
+
+// Runs the measurement in a new process and keeps each benchmark's fastest result so far.
+// Slow or fast, the state of a process lasts its whole run.
+static void MeasureProcess(const char* command, std::vector<BenchmarkResult>& results)
+{
+	FILE* child = popen(command, "r");
+	if (child == nullptr)
+	{
+		fprintf(stderr, "Unable to run %s\n", command);
+		exit(2);
+	}
+	const std::vector<BaselineEntry> entries = ReadEntries(child);
+	if (pclose(child) != 0 || entries.empty())
+	{
+		fprintf(stderr, "Measurement failed: %s\n", command);
+		exit(2);
+	}
+
+	for (const BaselineEntry& entry : entries)
+	{
+		bool found = false;
+		for (BenchmarkResult& result : results)
+		{
+			if (strcmp(result.Entry.Name, entry.Name) == 0 && strcmp(result.Entry.Cache, entry.Cache) == 0)
+			{
+				result.Entry.NanosPerOp = std::min(result.Entry.NanosPerOp, entry.NanosPerOp);
+				found = true;
+			}
+		}
+		if (!found)
+		{
+			BenchmarkResult result = { entry, 0 };
+			results.push_back(result);
+		}
+	}
+}
+
+static const bool IsRegressed(const std::vector<BenchmarkResult>& results)
+{
+	for (const BenchmarkResult& result : results)
+	{
+		if (result.Limit > 0 && result.Entry.NanosPerOp > result.Limit)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	const char* baselinePath = nullptr;
+	const char* filter = nullptr;
+	double tolerance = 25;
+	double slack = 1;
+	uint32_t samples = 101;
+	uint32_t runs = 3;
+	uint32_t retries = 3;
+	bool child = false;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--baseline") == 0) baselinePath = argv[i + 1];
+		else if (strcmp(argv[i], "--tolerance") == 0) tolerance = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "--slack") == 0) slack = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "--filter") == 0) filter = argv[i + 1];
+		else if (strcmp(argv[i], "--samples") == 0) samples = std::max(1, atoi(argv[i + 1]));
+		else if (strcmp(argv[i], "--runs") == 0) runs = std::max(1, atoi(argv[i + 1]));
+		else if (strcmp(argv[i], "--retries") == 0) retries = (uint32_t)std::max(0, atoi(argv[i + 1]));
+		else if (strcmp(argv[i], "--child") == 0) child = atoi(argv[i + 1]) != 0;
+	}
+
+	if (child)
+	{
+		MeasureAll(samples, filter);
+
+		return 0;
+	}
+
+	std::vector<BaselineEntry> baseline;
+	if (baselinePath != nullptr)
+	{
+		baseline = LoadBaseline(baselinePath);
+	}
+
+	char command[512];
+	snprintf(command, sizeof(command), "\"%s\" --child 1 --samples %lu%s%s%s", argv[0],
+		(unsigned long)samples, (filter != nullptr) ? " --filter \"" : "",
+		(filter != nullptr) ? filter : "", (filter != nullptr) ? "\"" : "");
+
+	std::vector<BenchmarkResult> results;
+	for (uint32_t run = 0; run < runs; run++)
+	{
+		MeasureProcess(command, results);
+	}
+
+	// The cold driver call is mostly refills of the whole driver's state, too noisy to gate.
+	for (BenchmarkResult& result : results)
+	{
+		const BaselineEntry* entry = FindBaseline(baseline, result.Entry.Name, result.Entry.Cache);
+		const bool gated = strcmp(result.Entry.Cache, "warm") == 0 || strcmp(result.Entry.Name, "driver.send_packet") != 0;
+		if (entry != nullptr && gated)
+		{
+			result.Limit = std::max(entry->NanosPerOp * (1.0 + (tolerance / 100.0)), entry->NanosPerOp + slack);
+		}
+	}
+
+	// Host noise passes, a regression stays: only a result still over its limit after the retries fails.
+	for (uint32_t retry = 0; retry < retries && IsRegressed(results); retry++)
+	{
+		MeasureProcess(command, results);
+	}
+
+	printf("benchmark,cache,ns_per_op,limit_ns,status\n");
+	for (const BenchmarkResult& result : results)
+	{
+		if (result.Limit > 0)
+		{
+			const bool regressed = result.Entry.NanosPerOp > result.Limit;
+			printf("%s,%s,%.2f,%.2f,%s\n", result.Entry.Name, result.Entry.Cache, result.Entry.NanosPerOp,
+				result.Limit, regressed ? "fail" : "ok");
+		}
+		else
+		{
+			printf("%s,%s,%.2f,,\n", result.Entry.Name, result.Entry.Cache, result.Entry.NanosPerOp);
+		}
+	}
+
+	return IsRegressed(results) ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,317 @@
+// TraceToVcd.cpp
+// Converts PIM_TRACE dumps to VCD, for a waveform viewer.
+// Reads "source,timestamp,state,verdict" lines, as printed by PulseTraceRing::Dump(),
+// source R for the reader and W for the writer. Other lines are skipped,
+// so a whole serial log can be fed in.
+//
+// Each source gets a pulse signal and its state and verdict as 8 bit values,
+// decoded in the VCD header comment.
+// Timeout and Aborted entries only change the state and verdict.
+// Time is in micro-seconds, 32 bit roll-over is unwrapped.
+// The reader pulses can be decoded again with PulseCaptureDecoder --signal reader_pulse.
+//
+// Build:
+// g++ -O2 -std=c++11 -I src extras/TraceToVcd/TraceToVcd.cpp -o TraceToVcd
+//
+// Usage:
+// TraceToVcd [options] [dump.txt]
+//	-o <file>			Output file, default stdout.
+//	--width <us>		Pulse width, default 1.
+//
+// Reads stdin if no dump file is given.
+
+#include <PulseIntervalModulator/PulseTrace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+// Same values as TemplatePacketReader::StateEnum.
+static const char* const ReaderStateNames[] = {
+	"Blanking",
+	"BlankingWithPendingPacket",
+	"WaitingForPreAmbleStart",
+	"WaitingForPreAmbleEnd",
+	"WaitingForHeaderEnd",
+	"WaitingForExtendedSize",
+	"WaitingForDataBits",
+	"WaitingForPacketClear",
+	"SkippingPacket",
+	"Monitoring",
+	"MonitoringWithPendingPacket"
+};
+
+// Same values as TemplatePacketWriter::WriteState.
+static const char* const WriterStateNames[] = {
+	"Done",
+	"WritingHeader",
+	"WritingDataBits",
+	"WritingExtendedSize"
+};
+
+static const char* GetVerdictName(const uint8_t verdict)
+{
+	switch (verdict)
+	{
+	case TraceStart: return "Start";
+	case TracePreamble: return "Preamble";
+	case TracePreambleReject: return "PreambleReject";
+	case TraceZero: return "Zero";
+	case TraceOne: return "One";
+	case TraceHeaderReject: return "HeaderReject";
+	case TraceSizeReject: return "SizeReject";
+	case TraceDataReject: return "DataReject";
+	case TraceGlitch: return "Glitch";
+	case TraceErasure: return "Erasure";
+	case TraceReceived: return "Received";
+	case TraceFiltered: return "Filtered";
+	case TraceSkipped: return "Skipped";
+	case TraceTimeout: return "Timeout";
+	case TraceEcho: return "Echo";
+	case TraceCollision: return "Collision";
+	case TracePulse: return "Pulse";
+	case TraceAborted: return "Aborted";
+	case TraceResync: return "Resync";
+	default: return nullptr;
+	}
+}
+
+// Timeouts and aborts are recorded by the silence poll and Stop(), there's no pulse behind them.
+static const bool IsPulse(const uint8_t verdict)
+{
+	return verdict != TraceTimeout && verdict != TraceAborted;
+}
+
+struct TraceEvent
+{
+	uint32_t Timestamp;
+	uint8_t State;
+	uint8_t Verdict;
+};
+
+enum SourceIndex
+{
+	ReaderSource,
+	WriterSource,
+	SourceCount
+};
+
+// Signal identifiers, per source: pulse, state, verdict.
+static const char SignalIds[SourceCount][3] = { { '!', '"', '#' }, { '$', '%', '&' } };
+static const char* const SourceNames[SourceCount] = { "reader", "writer" };
+
+static void PrintBinary(FILE* out, const uint8_t value, const char id)
+{
+	fputc('b', out);
+	for (int8_t bit = 7; bit >= 0; bit--)
+	{
+		fputc(((value >> bit) & 0x01) ? '1' : '0', out);
+	}
+	fprintf(out, " %c\n", id);
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = nullptr;
+	const char* outputPath = nullptr;
+	uint32_t width = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) outputPath = argv[++i];
+		else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) width = (uint32_t)atoi(argv[++i]);
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "Usage: TraceToVcd [-o output.vcd] [--width us] [dump.txt]\n");
+			return 1;
+		}
+		else path = argv[i];
+	}
+
+	if (width < 1)
+	{
+		width = 1;
+	}
+
+	FILE* file = stdin;
+	if (path != nullptr)
+	{
+		file = fopen(path, "r");
+		if (file == nullptr)
+		{
+			fprintf(stderr, "Unable to open %s\n", path);
+			return 1;
+		}
+	}
+
+	std::vector<TraceEvent> events[SourceCount];
+	char line[256];
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		char source = 0;
+		unsigned long timestamp = 0;
+		unsigned int state = 0, verdict = 0;
+		if (sscanf(line, " %c,%lu,%u,%u", &source, &timestamp, &state, &verdict) != 4
+			|| state > 0xFF || verdict > 0xFF)
+		{
+			continue;
+		}
+
+		TraceEvent event;
+		event.Timestamp = (uint32_t)timestamp;
+		event.State = (uint8_t)state;
+		event.Verdict = (uint8_t)verdict;
+
+		if (source == 'R') events[ReaderSource].push_back(event);
+		else if (source == 'W') events[WriterSource].push_back(event);
+	}
+
+	if (file != stdin)
+	{
+		fclose(file);
+	}
+
+	if (events[ReaderSource].empty() && events[WriterSource].empty())
+	{
+		fprintf(stderr, "No trace entries found.\n");
+		return 1;
+	}
+
+	// Both rings share the same micros(), align them on the first entry of either.
+	const uint32_t reference = events[ReaderSource].empty() ? events[WriterSource][0].Timestamp : events[ReaderSource][0].Timestamp;
+
+	// Unwrap each source, then shift so the earliest event is near 0.
+	std::vector<int64_t> times[SourceCount];
+	int64_t earliest = INT64_MAX;
+	for (uint8_t s = 0; s < SourceCount; s++)
+	{
+		if (events[s].empty())
+		{
+			continue;
+		}
+
+		int64_t time = (int32_t)(events[s][0].Timestamp - reference);
+		for (size_t i = 0; i < events[s].size(); i++)
+		{
+			if (i > 0)
+			{
+				time += (uint32_t)(events[s][i].Timestamp - events[s][i - 1].Timestamp);
+			}
+			times[s].push_back(time);
+		}
+
+		if (times[s][0] < earliest)
+		{
+			earliest = times[s][0];
+		}
+	}
+
+	// Value changes per time, per signal.
+	// Pulse ends go in first, so a pulse starting on another's end keeps it high.
+	static const int64_t LeadIn = 10;
+	std::map<uint64_t, std::map<char, int>> changes;
+	for (uint8_t s = 0; s < SourceCount; s++)
+	{
+		for (size_t i = 0; i < events[s].size(); i++)
+		{
+			if (IsPulse(events[s][i].Verdict))
+			{
+				const uint64_t time = (uint64_t)(times[s][i] - earliest + LeadIn);
+				changes[time + width].insert(std::make_pair(SignalIds[s][0], 0));
+			}
+		}
+	}
+	for (uint8_t s = 0; s < SourceCount; s++)
+	{
+		for (size_t i = 0; i < events[s].size(); i++)
+		{
+			const uint64_t time = (uint64_t)(times[s][i] - earliest + LeadIn);
+			std::map<char, int>& change = changes[time];
+			if (IsPulse(events[s][i].Verdict))
+			{
+				change[SignalIds[s][0]] = 1;
+			}
+			change[SignalIds[s][1]] = 0x100 | events[s][i].State;
+			change[SignalIds[s][2]] = 0x100 | events[s][i].Verdict;
+		}
+	}
+
+	FILE* out = stdout;
+	if (outputPath != nullptr)
+	{
+		out = fopen(outputPath, "w");
+		if (out == nullptr)
+		{
+			fprintf(stderr, "Unable to open %s\n", outputPath);
+			return 1;
+		}
+	}
+
+	fprintf(out, "$comment\n PulseIntervalModulator trace, first entry at %lu us.\n", (unsigned long)reference);
+	fprintf(out, " Reader states:");
+	for (uint8_t i = 0; i < sizeof(ReaderStateNames) / sizeof(ReaderStateNames[0]); i++)
+	{
+		fprintf(out, " %u=%s", i, ReaderStateNames[i]);
+	}
+	fprintf(out, "\n Writer states:");
+	for (uint8_t i = 0; i < sizeof(WriterStateNames) / sizeof(WriterStateNames[0]); i++)
+	{
+		fprintf(out, " %u=%s", i, WriterStateNames[i]);
+	}
+	fprintf(out, "\n Verdicts:");
+	for (uint16_t i = 0; i < 256; i++)
+	{
+		if (GetVerdictName((uint8_t)i) != nullptr)
+		{
+			fprintf(out, " %u=%s", i, GetVerdictName((uint8_t)i));
+		}
+	}
+	fprintf(out, "\n$end\n");
+	fprintf(out, "$timescale 1us $end\n");
+	fprintf(out, "$scope module pim $end\n");
+	for (uint8_t s = 0; s < SourceCount; s++)
+	{
+		fprintf(out, "$var wire 1 %c %s_pulse $end\n", SignalIds[s][0], SourceNames[s]);
+		fprintf(out, "$var wire 8 %c %s_state $end\n", SignalIds[s][1], SourceNames[s]);
+		fprintf(out, "$var wire 8 %c %s_verdict $end\n", SignalIds[s][2], SourceNames[s]);
+	}
+	fprintf(out, "$upscope $end\n");
+	fprintf(out, "$enddefinitions $end\n");
+
+	fprintf(out, "#0\n$dumpvars\n");
+	for (uint8_t s = 0; s < SourceCount; s++)
+	{
+		fprintf(out, "0%c\n", SignalIds[s][0]);
+		fprintf(out, "bxxxxxxxx %c\n", SignalIds[s][1]);
+		fprintf(out, "bxxxxxxxx %c\n", SignalIds[s][2]);
+	}
+	fprintf(out, "$end\n");
+
+	for (auto it = changes.begin(); it != changes.end(); ++it)
+	{
+		fprintf(out, "#%llu\n", (unsigned long long)it->first);
+		for (auto change = it->second.begin(); change != it->second.end(); ++change)
+		{
+			if (change->second > 1)
+			{
+				PrintBinary(out, (uint8_t)change->second, change->first);
+			}
+			else
+			{
+				fprintf(out, "%d%c\n", change->second, change->first);
+			}
+		}
+	}
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+
+	fprintf(stderr, "%u reader and %u writer entries.\n",
+		(unsigned)events[ReaderSource].size(), (unsigned)events[WriterSource].size());
+
+	return 0;
+}
\ No newline at end of file
@@ -3,7 +3,8 @@
 #ifndef _PULSE_INTERVAL_MODULATOR_h
 #define _PULSE_INTERVAL_MODULATOR_h
 
-#include "PulseIntervalModulator\PacketReader.h"
-#include "PulseIntervalModulator\PacketWriter.h"
+#include "PulseIntervalModulator/PacketReader.h"
+#include "PulseIntervalModulator/PacketWriter.h"
+#include "PulseIntervalModulator/PacketRepeater.h"
 
 #endif
\ No newline at end of file
@@ -10,6 +10,73 @@
 // Remove checks for a faster operation, once flow is validated.
 #define PIM_SAFETY_CHECKS
 
+// Abort truncated packets after a bit interval of silence.
+// Polled with PacketReader::CheckTimeout(), PulsePacketTaskDriver does it on every pass, and about every millisecond while idle.
+//#define PIM_SILENCE_TIMEOUT
+
+// Drop packets whose first data byte doesn't match the reader's address filter,
+// as soon as that byte is in. See PacketReader::SetAddressFilter().
+//#define PIM_ADDRESS_FILTER
+
+// Count received packets and rejected pulses by reason, see PacketReader::GetStats().
+//#define PIM_READER_STATS
+
+// Ignore pulses that come too soon to be a bit, instead of dropping the packet.
+// Up to PIM_GLITCH_BUDGET spikes are tolerated per packet.
+// A spike that lands in a valid bit window still corrupts the packet, undetected:
+// pair with an integrity check in the payload.
+//#define PIM_GLITCH_FILTER
+
+// Header value 63 escapes to a variable length size, for packets up to 4 KiB.
+// Packet sizes and counters widen to 16 bits, see PacketSizeType.
+// All nodes on the link must agree on this setting.
+//#define PIM_EXTENDED_HEADER
+
+// Header carries a rate bit, the payload can be sent with the fast timing profile.
+// Preamble and header always use the base profile.
+// All nodes on the link must agree on this setting.
+// On AVR, needs PIM_AVR_WRITER_TIMER 1 or 2.
+//#define PIM_RATE_SWITCHING
+
+// Data bytes are sent as 13 bit SECDED Hamming code words, see HammingCode.h.
+// Bit intervals out of window are taken as erasures and filled in,
+// instead of dropping the packet. Costs 62.5% more payload airtime.
+// Header and extended size are not covered.
+// All nodes on the link must agree on this setting.
+//#define PIM_FEC
+
+// PulsePacketTaskDriver::QueuePacket() sends with carrier sense and random backoff.
+// The reader checks the line read back while sending and aborts on collision,
+// this needs a shared line where each node sees its own pulses.
+//#define PIM_CSMA
+
+// Reader and writer record their last PIM_TRACE_SIZE pulses, see PulseTrace.h.
+// The reader's ring freezes on packet loss, the writer's on abort.
+//#define PIM_TRACE
+
+// Writer timestamps each packet's start pulse, for PulseTimeSync beacons.
+//#define PIM_TIME_SYNC
+
+// PulsePacketTaskDriver::QueuePacket() takes a priority class and an optional deadline.
+// The most urgent class goes first, earliest deadline first within it, expired packets are dropped.
+// Works with or without PIM_CSMA.
+//#define PIM_SEND_SCHEDULER
+
+// Packets can be streamed without a buffer, through the reader and writer handler policies.
+// TemplatePacketWriter::SendStream() asks the handler for each byte, one byte ahead.
+// TemplatePacketReader without a buffer hands each byte to the handler as it completes.
+//#define PIM_STREAMING
+
+// After a preamble, header or size reject, the last PIM_RESYNC_CANDIDATES pulses
+// are tried as the start pulse too, not only the last one.
+// Recovers the packet that follows a noise pulse, or has one in its preamble.
+//#define PIM_RESYNC
+
+// Queued sending, with carrier sense or priorities.
+#if defined(PIM_CSMA) || defined(PIM_SEND_SCHEDULER)
+#define PIM_SEND_QUEUE
+#endif
+
 // Use optimized AVR Fast IO library, if device is AVR.
 #if defined(ARDUINO_ARCH_AVR)
 #define PIM_USE_FAST
@@ -21,22 +88,149 @@
 #endif
 #endif
 
+// Select the AVR writer timer.
+// 0: Timer0 (default), shared with micros(), 4 us resolution.
+// 1: Timer1, 16 bit, prescaler PIM_AVR_TIMER1_PRESCALER (1 or 8).
+// 2: Timer2, 8 bit, prescaler PIM_AVR_TIMER2_PRESCALER (8 or 32).
+// Timer1 and Timer2 are taken over entirely, along with their PWM pins.
+#if !defined(PIM_AVR_WRITER_TIMER)
+#define PIM_AVR_WRITER_TIMER 0
+#endif
+
+#if !defined(PIM_AVR_TIMER1_PRESCALER)
+#define PIM_AVR_TIMER1_PRESCALER 8
+#endif
+
+#if !defined(PIM_AVR_TIMER2_PRESCALER)
+#define PIM_AVR_TIMER2_PRESCALER 8
+#endif
+
+// Timing profile, in micro-seconds.
+// Can be overriden for faster links, when using a high resolution timer.
+#if !defined(PIM_PREAMBLE_INTERVAL)
+#define PIM_PREAMBLE_INTERVAL 100
+#endif
+
+#if !defined(PIM_ZERO_INTERVAL)
+#define PIM_ZERO_INTERVAL 50
+#endif
+
+#if !defined(PIM_ONE_INTERVAL)
+#define PIM_ONE_INTERVAL 75
+#endif
+
+#if !defined(PIM_INTERVAL_TOLERANCE)
+#define PIM_INTERVAL_TOLERANCE 14
+#endif
+
+// Fast timing profile for the payload, with PIM_RATE_SWITCHING.
+#if !defined(PIM_FAST_ZERO_INTERVAL)
+#define PIM_FAST_ZERO_INTERVAL 24
+#endif
+
+#if !defined(PIM_FAST_ONE_INTERVAL)
+#define PIM_FAST_ONE_INTERVAL 40
+#endif
+
+#if !defined(PIM_FAST_INTERVAL_TOLERANCE)
+#define PIM_FAST_INTERVAL_TOLERANCE 7
+#endif
+
+#if !defined(PIM_GLITCH_BUDGET)
+#define PIM_GLITCH_BUDGET 4
+#endif
+
+// CSMA backoff window is 2^exponent slots, widened on each busy line or collision.
+// Set both exponents to 0 for no backoff.
+#if !defined(PIM_CSMA_MIN_BACKOFF_EXPONENT)
+#define PIM_CSMA_MIN_BACKOFF_EXPONENT 2
+#endif
+
+#if !defined(PIM_CSMA_MAX_BACKOFF_EXPONENT)
+#define PIM_CSMA_MAX_BACKOFF_EXPONENT 6
+#endif
+
+// Packet is dropped after this many collisions, a busy line only delays it.
+#if !defined(PIM_CSMA_MAX_ATTEMPTS)
+#define PIM_CSMA_MAX_ATTEMPTS 8
+#endif
+
+#if !defined(PIM_SEND_QUEUE_SIZE)
+#define PIM_SEND_QUEUE_SIZE 2
+#endif
+
+// Segments per scattered packet, PacketWriter::SendPacket(segments, segmentCount).
+#if !defined(PIM_MAX_PACKET_SEGMENTS)
+#define PIM_MAX_PACKET_SEGMENTS 4
+#endif
+
+// Priority classes, 0 is the most urgent.
+#if !defined(PIM_SEND_PRIORITY_CLASSES)
+#define PIM_SEND_PRIORITY_CLASSES 3
+#endif
+
+#if !defined(PIM_TRACE_SIZE)
+#define PIM_TRACE_SIZE 32
+#endif
+
+// Recent pulses kept as possible start pulses, with PIM_RESYNC.
+#if !defined(PIM_RESYNC_CANDIDATES)
+#define PIM_RESYNC_CANDIDATES 2
+#endif
+
+// Receiver start pulse timestamp lag to the sender's, interrupt entry and micros() read.
+#if !defined(PIM_TIME_SYNC_LATENCY)
+#define PIM_TIME_SYNC_LATENCY 0
+#endif
+
 
 #include <stdint.h>
 
+#if defined(PIM_EXTENDED_HEADER)
+typedef uint16_t PacketSizeType;
+#else
+typedef uint8_t PacketSizeType;
+#endif
+
 class Constants
 {
 public:
 	static const uint8_t MinDataBytes = 1; // 0b000000
-	static const uint8_t MaxDataBytes = 64; // 0b111111 + 1
 	static const uint8_t HeaderBits = 6;
 
+	// Rate bit sent after the size bits, 1 for the fast payload profile.
+#if defined(PIM_RATE_SWITCHING)
+	static const uint8_t RateBits = 1;
+#else
+	static const uint8_t RateBits = 0;
+#endif
+	static const uint8_t HeaderFieldBits = HeaderBits + RateBits;
+
+#if defined(PIM_EXTENDED_HEADER)
+	// Header value that announces an extended size.
+	static const uint8_t HeaderEscape = 0b111111;
+
+	// Extended size follows the header, in 7 bit groups MSB first,
+	// each sent as 8 bits with the top bit set if another group follows.
+	// Size is ExtendedBaseBytes + the extended size value.
+	static const uint8_t ExtendedGroupBits = 7;
+	static const uint8_t ExtendedBaseBytes = HeaderEscape + MinDataBytes; // 64
+	static const PacketSizeType MaxDataBytes = 4096;
+
+	// Enough groups for MaxDataBytes.
+	static const uint8_t MaxExtendedGroups = 2;
+	static_assert((MaxDataBytes - ExtendedBaseBytes) < (1UL << (ExtendedGroupBits * MaxExtendedGroups)),
+		"MaxExtendedGroups too small for MaxDataBytes.");
+#else
+	static const PacketSizeType MaxDataBytes = 64; // 0b111111 + 1
+#endif
+
 	// All intervals in micro-seconds.
-	static const uint32_t PreambleInterval = 100;
-	static const uint32_t ZeroInterval = 50;
-	static const uint32_t OneInterval = 75;
+	static const uint32_t PreambleInterval = PIM_PREAMBLE_INTERVAL;
+	static const uint32_t ZeroInterval = PIM_ZERO_INTERVAL;
+	static const uint32_t OneInterval = PIM_ONE_INTERVAL;
 
-	static const uint8_t IntervalTolerance = 14;
+	static const uint8_t IntervalTolerance = PIM_INTERVAL_TOLERANCE;
 
 	static const uint32_t ZeroIntervalMin = ZeroInterval - IntervalTolerance;
 	static const uint32_t ZeroIntervalMax = ZeroInterval + IntervalTolerance;
@@ -47,6 +241,92 @@ public:
 	static const uint32_t PreambleIntervalMin = PreambleInterval - IntervalTolerance;
 	static const uint32_t PreambleIntervalMax = PreambleInterval + IntervalTolerance;
 
+#if defined(PIM_RATE_SWITCHING)
+	static const uint32_t FastZeroInterval = PIM_FAST_ZERO_INTERVAL;
+	static const uint32_t FastOneInterval = PIM_FAST_ONE_INTERVAL;
+
+	static const uint8_t FastIntervalTolerance = PIM_FAST_INTERVAL_TOLERANCE;
+
+	static const uint32_t FastZeroIntervalMin = FastZeroInterval - FastIntervalTolerance;
+	static const uint32_t FastOneIntervalMin = FastOneInterval - FastIntervalTolerance;
+	static const uint32_t FastOneIntervalMax = FastOneInterval + FastIntervalTolerance;
+
+	static_assert((FastZeroInterval + FastIntervalTolerance) < FastOneIntervalMin,
+		"Fast profile bit windows overlap.");
+	static_assert(FastOneIntervalMax <= OneIntervalMax,
+		"Fast profile must be faster than the base profile.");
+#endif
+
+#if defined(PIM_FEC)
+	// Bits sent per data byte.
+	static const uint8_t DataWordBits = 13;
+
+	// Late pulses are still taken as erasures, up to one more tolerance.
+	static const uint32_t ErasureIntervalMax = OneIntervalMax + IntervalTolerance;
+#if defined(PIM_RATE_SWITCHING)
+	static const uint32_t FastErasureIntervalMax = FastOneIntervalMax + FastIntervalTolerance;
+#endif
+#else
+	static const uint8_t DataWordBits = 8;
+#endif
+
+	static const uint8_t MaxPacketSegments = PIM_MAX_PACKET_SEGMENTS;
+
+	static_assert(MaxPacketSegments > 0, "At least one packet segment.");
+
+	// Spurious pulses ignored per packet, with PIM_GLITCH_FILTER.
+	static const uint8_t GlitchBudget = PIM_GLITCH_BUDGET;
+
+#if defined(PIM_CSMA)
+	static const uint8_t MinBackoffExponent = PIM_CSMA_MIN_BACKOFF_EXPONENT;
+	static const uint8_t MaxBackoffExponent = PIM_CSMA_MAX_BACKOFF_EXPONENT;
+	static const uint8_t MaxSendAttempts = PIM_CSMA_MAX_ATTEMPTS;
+
+	// Backoff time unit.
+	static const uint32_t BackoffSlotInterval = PreambleInterval;
+
+	static_assert(MinBackoffExponent <= MaxBackoffExponent && MaxBackoffExponent < 16,
+		"Invalid CSMA backoff exponents.");
+
+	// Own pulses read back while sending are never closer than this, a foreign pulse splits an interval.
+#if defined(PIM_RATE_SWITCHING)
+	static const uint32_t MonitorIntervalMin = FastZeroIntervalMin;
+#else
+	static const uint32_t MonitorIntervalMin = ZeroIntervalMin;
+#endif
+#endif
+
+#if defined(PIM_SEND_QUEUE)
+	static const uint8_t SendQueueSize = PIM_SEND_QUEUE_SIZE;
+
+	static_assert(SendQueueSize > 0, "Send queue must hold at least one packet.");
+#endif
+
+#if defined(PIM_SEND_SCHEDULER)
+	static const uint8_t SendPriorityClasses = PIM_SEND_PRIORITY_CLASSES;
+
+	static_assert(SendPriorityClasses > 0, "At least one priority class.");
+#endif
+
+	// Trace ring entries, with PIM_TRACE.
+	static const uint8_t TraceSize = PIM_TRACE_SIZE;
+
+#if defined(PIM_RESYNC)
+	static const uint8_t ResyncCandidates = PIM_RESYNC_CANDIDATES;
+
+	static_assert(ResyncCandidates > 0 && ResyncCandidates <= 4, "ResyncCandidates must be 1 to 4.");
+#endif
+
+	// Subtracted from beacon receive timestamps, in PulseTimeSync.
+	static const uint32_t TimeSyncLatency = PIM_TIME_SYNC_LATENCY;
+
+	// No valid bit can take longer than this, the packet was truncated.
+#if defined(PIM_FEC)
+	static const uint32_t SilenceTimeoutInterval = ErasureIntervalMax;
+#else
+	static const uint32_t SilenceTimeoutInterval = OneIntervalMax;
+#endif
+
 	// Make sure we wait at least a bit over a pre amble before sending again.
 	static const uint32_t ReceiveSilenceInterval = PreambleIntervalMax + IntervalTolerance;
 
@@ -0,0 +1,155 @@
+// HammingCode.h
+// Extended Hamming(13,8) SECDED code for PIM_FEC, one code word per data byte.
+// Code words are 13 bits, sent MSB first as positions 1 to 13,
+// with the parity bits at positions 1, 2, 4 and 8 and the overall parity of the word at position 13.
+// The syndrome of a word with a single flipped bit is that bit's position,
+// so the decoder needs no lookup table beyond the parity nibble.
+// Two flipped bits leave the overall parity even with a non zero syndrome, they're detected, not corrected.
+//
+// Erased bits, whose position is known but value isn't, cost half as much as errors:
+// a word can have one error, or up to MaxErasures erasures, but not both.
+// An error on top of the erasures is detected too.
+
+#ifndef _PIM_HAMMING_CODE_h
+#define _PIM_HAMMING_CODE_h
+
+#include <stdint.h>
+
+class HammingCode
+{
+public:
+	static const uint8_t CodeBits = 13;
+	static const uint8_t MaxErasures = 2;
+
+private:
+	// Word bits checked by each syndrome bit, position p is word bit (CodeBits - p).
+	static const uint16_t ParityMask1 = 0b1010101010100; // Positions 1, 3, 5, 7, 9, 11.
+	static const uint16_t ParityMask2 = 0b0110011001100; // Positions 2, 3, 6, 7, 10, 11.
+	static const uint16_t ParityMask4 = 0b0001111000010; // Positions 4, 5, 6, 7, 12.
+	static const uint16_t ParityMask8 = 0b0000000111110; // Positions 8, 9, 10, 11, 12.
+
+	// Overall parity, position 13, the last bit sent.
+	static const uint8_t OverallPosition = CodeBits;
+
+	// Parity of each nibble value, as a 16 bit table.
+	static const uint16_t NibbleParity = 0x6996;
+
+public:
+	static const uint16_t Encode(const uint8_t value)
+	{
+		// Data bits go to positions 3, 5, 6, 7, 9, 10, 11 and 12.
+		uint16_t word = ((uint16_t)(value & 0x80) << 3)
+			| ((uint16_t)(value & 0x70) << 2)
+			| ((uint16_t)(value & 0x0F) << 1);
+
+		// Parity bits are still clear, so each syndrome bit is its parity bit.
+		const uint8_t syndrome = GetSyndrome(word);
+		if (syndrome & 0x01) word |= 1 << (CodeBits - 1);
+		if (syndrome & 0x02) word |= 1 << (CodeBits - 2);
+		if (syndrome & 0x04) word |= 1 << (CodeBits - 4);
+		if (syndrome & 0x08) word |= 1 << (CodeBits - 8);
+
+		// Overall parity bit is still clear too, this makes the whole word even.
+		word |= GetParity(word);
+
+		return word;
+	}
+
+	// erasures holds the word bit index of each unknown bit, which must be clear in word.
+	// Returns false if the word can't be corrected, such as two flipped bits.
+	// correctedBits is the number of erased or flipped bits recovered.
+	static const bool Decode(uint16_t word, const uint8_t* erasures, const uint8_t erasureCount,
+		uint8_t& value, uint8_t& correctedBits)
+	{
+		const uint8_t syndrome = GetSyndrome(word);
+		const uint8_t parity = GetParity(word);
+
+		if (erasureCount == 0)
+		{
+			correctedBits = 0;
+			if (parity != 0)
+			{
+				if (syndrome >= OverallPosition)
+				{
+					// Not a single bit error.
+					return false;
+				}
+
+				// A zero syndrome is the overall parity bit itself.
+				word ^= 1 << (CodeBits - ((syndrome == 0) ? OverallPosition : syndrome));
+				correctedBits = 1;
+			}
+			else if (syndrome != 0)
+			{
+				// Two flipped bits.
+				return false;
+			}
+		}
+		else
+		{
+			// Find which erased bits are set, their positions add up to the syndrome
+			// and their count makes the word even. The overall parity bit isn't in the syndrome.
+			uint8_t combination = 0;
+			for (; combination < (1 << erasureCount); combination++)
+			{
+				uint8_t positions = 0;
+				uint8_t setBits = 0;
+				for (uint8_t i = 0; i < erasureCount; i++)
+				{
+					if (combination & (1 << i))
+					{
+						const uint8_t position = CodeBits - erasures[i];
+						if (position != OverallPosition)
+						{
+							positions ^= position;
+						}
+						setBits ^= 1;
+					}
+				}
+
+				if (positions == syndrome
+					&& setBits == parity)
+				{
+					break;
+				}
+			}
+
+			if (combination >= (1 << erasureCount))
+			{
+				// Erasures and an error, too much for the code.
+				return false;
+			}
+
+			for (uint8_t i = 0; i < erasureCount; i++)
+			{
+				if (combination & (1 << i))
+				{
+					word |= 1 << erasures[i];
+				}
+			}
+			correctedBits = erasureCount;
+		}
+
+		value = ((word >> 3) & 0x80) | ((word >> 2) & 0x70) | ((word >> 1) & 0x0F);
+
+		return true;
+	}
+
+private:
+	static const uint8_t GetSyndrome(const uint16_t word)
+	{
+		return GetParity(word & ParityMask1)
+			| (GetParity(word & ParityMask2) << 1)
+			| (GetParity(word & ParityMask4) << 2)
+			| (GetParity(word & ParityMask8) << 3);
+	}
+
+	static const uint8_t GetParity(uint16_t bits)
+	{
+		bits ^= bits >> 8;
+		bits ^= bits >> 4;
+
+		return (NibbleParity >> (bits & 0x0F)) & 0x01;
+	}
+};
+#endif
\ No newline at end of file
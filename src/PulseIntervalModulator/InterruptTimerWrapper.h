@@ -4,7 +4,7 @@
 #define _INTERRUPT_TIMER_WRAPPER_h
 
 
-#if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_STM32F1)
+#if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_STM32F1) || defined(PIM_HOST)
 #else
 #error No timer wrapper implementation .
 #endif	
@@ -15,7 +15,7 @@
 #include <Arduino.h>
 #include <HardwareTimer.h>
 
-#include "PulseIntervalModulator\Constants.h"
+#include "Constants.h"
 
 class InterruptTimerWrapper
 {
@@ -88,14 +88,28 @@ public:
 		InterruptAfterMicros(Constants::ZeroInterval);
 	}
 
+#if defined(PIM_RATE_SWITCHING)
+	void InterruptAfterFastOne()
+	{
+		InterruptAfterMicros(Constants::FastOneInterval);
+	}
+
+	void InterruptAfterFastZero()
+	{
+		InterruptAfterMicros(Constants::FastZeroInterval);
+	}
+#endif
+
 	void InterruptAfterPreamble()
 	{
 		InterruptAfterMicros(Constants::PreambleInterval);
 	}
 };
 #undef DeviceTimer
-#elif defined(ARDUINO_ARCH_AVR)
+#elif defined(ARDUINO_ARCH_AVR) && (PIM_AVR_WRITER_TIMER == 0)
 #include <Arduino.h>
+#include "Constants.h"
+
 // This class re-uses the same timer used for the native "micros()" call,
 // by taking over OCR0A.
 class InterruptTimerWrapper
@@ -119,6 +133,14 @@ private:
 	static const uint8_t TimerClocksDivisor = 64;
 #endif
 
+	static_assert(Constants::PreambleInterval == 100
+		&& Constants::ZeroInterval == 50
+		&& Constants::OneInterval == 75,
+		"Timer0 durations are tuned for the default timing profile. Use Timer1 or Timer2 for a custom profile.");
+
+#if defined(PIM_RATE_SWITCHING)
+#error Timer0 has no tuned fast profile, rate switching needs PIM_AVR_WRITER_TIMER 1 or 2.
+#endif
 
 public:
 	static constexpr uint16_t GetClocksFromMicros(const uint32_t delayMicros)
@@ -216,5 +238,401 @@ public:
 		InterruptAfterClocks((uint8_t)InterruptDuration::PreAmble);
 	}
 };
+#elif defined(ARDUINO_ARCH_AVR) && (PIM_AVR_WRITER_TIMER == 1)
+#include <Arduino.h>
+#include "Constants.h"
+
+#if defined(ARDUINO_AVR_ATTINYX5)
+#error Timer1 backend is not available on ATtinyX5.
+#endif
+
+// Dedicated 16 bit Timer1 on OCR1A, free running in Normal mode.
+// Durations are computed from the timing profile.
+class InterruptTimerWrapper
+{
+private:
+	static const uint8_t TimerClocksDivisor = PIM_AVR_TIMER1_PRESCALER;
+
+#if (PIM_AVR_TIMER1_PRESCALER == 1)
+	static const uint8_t PrescalerBits = (1 << CS10);
+#elif (PIM_AVR_TIMER1_PRESCALER == 8)
+	static const uint8_t PrescalerBits = (1 << CS11);
+#else
+#error Timer1 prescaler must be 1 or 8.
+#endif
+
+public:
+	static constexpr uint16_t GetClocksFromMicros(const uint32_t delayMicros)
+	{
+		return (clockCyclesPerMicrosecond() * delayMicros) / TimerClocksDivisor;
+	}
+
+private:
+	static const uint16_t PreAmbleClocks = GetClocksFromMicros(Constants::PreambleInterval);
+	static const uint16_t ZeroClocks = GetClocksFromMicros(Constants::ZeroInterval);
+	static const uint16_t OneClocks = GetClocksFromMicros(Constants::OneInterval);
+
+	static_assert(((uint32_t)clockCyclesPerMicrosecond() * Constants::PreambleInterval) / TimerClocksDivisor <= UINT16_MAX,
+		"Preamble interval overflows Timer1, use a larger prescaler.");
+	static_assert((ZeroClocks > 0) && (ZeroClocks < OneClocks) && (OneClocks < PreAmbleClocks),
+		"Timing profile intervals must be distinct in Timer1 clocks.");
+	static_assert((TimerClocksDivisor / clockCyclesPerMicrosecond()) < Constants::IntervalTolerance,
+		"Timer1 resolution is coarser than the interval tolerance.");
+
+#if defined(PIM_RATE_SWITCHING)
+	static const uint16_t FastZeroClocks = GetClocksFromMicros(Constants::FastZeroInterval);
+	static const uint16_t FastOneClocks = GetClocksFromMicros(Constants::FastOneInterval);
+
+	static_assert((FastZeroClocks > 0) && (FastZeroClocks < FastOneClocks),
+		"Fast profile intervals must be distinct in Timer1 clocks.");
+	static_assert((TimerClocksDivisor / clockCyclesPerMicrosecond()) < Constants::FastIntervalTolerance,
+		"Timer1 resolution is coarser than the fast interval tolerance.");
+#endif
+
+public:
+	static void DetachInterrupt()
+	{
+		// Disable interrupt.
+		TIMSK1 &= ~(1 << OCIE1A);
+
+		// Clear interrupt flag.
+		TIFR1 |= (1 << OCF1A);
+	}
+
+	static void ConfigureTimer()
+	{
+		noInterrupts();
+		uint8_t oldSREG = SREG;
+
+		// Normal mode, compare outputs disconnected.
+		TCCR1A = 0;
+		TCCR1B = PrescalerBits;
+		TCCR1C = 0;
+
+		SREG = oldSREG;
+		interrupts();
+	}
+
+	static void AttachInterrupt()
+	{
+		DetachInterrupt();
+		ConfigureTimer();
+	}
+
+	static void InterruptAfterOne()
+	{
+		InterruptAfterClocks(OneClocks);
+	}
+
+	static void InterruptAfterZero()
+	{
+		InterruptAfterClocks(ZeroClocks);
+	}
+
+#if defined(PIM_RATE_SWITCHING)
+	static void InterruptAfterFastOne()
+	{
+		InterruptAfterClocks(FastOneClocks);
+	}
+
+	static void InterruptAfterFastZero()
+	{
+		InterruptAfterClocks(FastZeroClocks);
+	}
+#endif
+
+	static void InterruptAfterClocks(const uint16_t clocks)
+	{
+		// Clear the interrupt flag while we setup the next one.
+		TIFR1 |= (1 << OCF1A);
+
+		// Set the new compare value, 16 bit roll-over is implicit.
+		OCR1A = TCNT1 + clocks;
+
+		// Enable interrupt.
+		TIMSK1 |= (1 << OCIE1A);
+	}
+
+	static void InterruptAfterPreamble()
+	{
+		InterruptAfterClocks(PreAmbleClocks);
+	}
+};
+#elif defined(ARDUINO_ARCH_AVR) && (PIM_AVR_WRITER_TIMER == 2)
+#include <Arduino.h>
+#include "Constants.h"
+
+#if defined(ARDUINO_AVR_ATTINYX5)
+#error Timer2 backend is not available on ATtinyX5.
+#endif
+
+// Dedicated 8 bit Timer2 on OCR2A, free running in Normal mode.
+// Durations are computed from the timing profile.
+// Disables tone() and PWM on Timer2 pins.
+class InterruptTimerWrapper
+{
+private:
+	static const uint8_t TimerClocksDivisor = PIM_AVR_TIMER2_PRESCALER;
+
+#if (PIM_AVR_TIMER2_PRESCALER == 8)
+	static const uint8_t PrescalerBits = (1 << CS21);
+#elif (PIM_AVR_TIMER2_PRESCALER == 32)
+	static const uint8_t PrescalerBits = (1 << CS21) | (1 << CS20);
+#else
+#error Timer2 prescaler must be 8 or 32.
+#endif
+
+public:
+	static constexpr uint16_t GetClocksFromMicros(const uint32_t delayMicros)
+	{
+		return (clockCyclesPerMicrosecond() * delayMicros) / TimerClocksDivisor;
+	}
+
+private:
+	static const uint16_t PreAmbleClocks = GetClocksFromMicros(Constants::PreambleInterval);
+	static const uint16_t ZeroClocks = GetClocksFromMicros(Constants::ZeroInterval);
+	static const uint16_t OneClocks = GetClocksFromMicros(Constants::OneInterval);
+
+	static_assert(PreAmbleClocks <= UINT8_MAX,
+		"Preamble interval overflows Timer2, use a larger prescaler.");
+	static_assert((ZeroClocks > 0) && (ZeroClocks < OneClocks) && (OneClocks < PreAmbleClocks),
+		"Timing profile intervals must be distinct in Timer2 clocks.");
+	static_assert((TimerClocksDivisor / clockCyclesPerMicrosecond()) < Constants::IntervalTolerance,
+		"Timer2 resolution is coarser than the interval tolerance.");
+
+#if defined(PIM_RATE_SWITCHING)
+	static const uint16_t FastZeroClocks = GetClocksFromMicros(Constants::FastZeroInterval);
+	static const uint16_t FastOneClocks = GetClocksFromMicros(Constants::FastOneInterval);
+
+	static_assert((FastZeroClocks > 0) && (FastZeroClocks < FastOneClocks),
+		"Fast profile intervals must be distinct in Timer2 clocks.");
+	static_assert((TimerClocksDivisor / clockCyclesPerMicrosecond()) < Constants::FastIntervalTolerance,
+		"Timer2 resolution is coarser than the fast interval tolerance.");
+#endif
+
+public:
+	static void DetachInterrupt()
+	{
+		// Disable interrupt.
+		TIMSK2 &= ~(1 << OCIE2A);
+
+		// Clear interrupt flag.
+		TIFR2 |= (1 << OCF2A);
+	}
+
+	static void ConfigureTimer()
+	{
+		noInterrupts();
+		uint8_t oldSREG = SREG;
+
+		// Normal mode, compare outputs disconnected, synchronous clock.
+		ASSR &= ~(1 << AS2);
+		TCCR2A = 0;
+		TCCR2B = PrescalerBits;
+
+		SREG = oldSREG;
+		interrupts();
+	}
+
+	static void AttachInterrupt()
+	{
+		DetachInterrupt();
+		ConfigureTimer();
+	}
+
+	static void InterruptAfterOne()
+	{
+		InterruptAfterClocks((uint8_t)OneClocks);
+	}
+
+	static void InterruptAfterZero()
+	{
+		InterruptAfterClocks((uint8_t)ZeroClocks);
+	}
+
+#if defined(PIM_RATE_SWITCHING)
+	static void InterruptAfterFastOne()
+	{
+		InterruptAfterClocks((uint8_t)FastOneClocks);
+	}
+
+	static void InterruptAfterFastZero()
+	{
+		InterruptAfterClocks((uint8_t)FastZeroClocks);
+	}
+#endif
+
+	static void InterruptAfterClocks(const uint8_t clocks)
+	{
+		// Clear the interrupt flag while we setup the next one.
+		TIFR2 |= (1 << OCF2A);
+
+		// Set the new compare value, 8 bit roll-over is implicit.
+		OCR2A = (uint8_t)(TCNT2 + clocks);
+
+		// Enable interrupt.
+		TIMSK2 |= (1 << OCIE2A);
+	}
+
+	static void InterruptAfterPreamble()
+	{
+		InterruptAfterClocks((uint8_t)PreAmbleClocks);
+	}
+};
+#elif defined(PIM_HOST)
+#include <Arduino.h>
+#include "Constants.h"
+
+// Host mock backend, with a 1 us timer clock.
+// Nothing fires on its own: the host tool advances the simulated time
+// up to GetDeadline() and calls Fire().
+// Records the generated compare sequence and verifies it against the protocol:
+// a preamble only starts a sequence, every other interval is a zero or a one.
+class InterruptTimerWrapper
+{
+public:
+#if defined(PIM_EXTENDED_HEADER)
+	static const uint16_t SequenceSize = ((uint16_t)Constants::MaxDataBytes * Constants::DataWordBits) + 64;
+#else
+	static const uint16_t SequenceSize = 1024;
+#endif
+
+private:
+	void (*Callback)(void) = nullptr;
+
+	uint32_t Sequence[SequenceSize];
+	uint16_t SequenceLength = 0;
+	uint32_t Violations = 0;
+
+	uint32_t Deadline = 0;
+	bool Armed = false;
+
+	// From the first compare until the writer detaches, Armed is clear while Fire() runs the callback.
+	bool InSequence = false;
+
+public:
+	InterruptTimerWrapper()
+	{
+	}
+
+	void DetachInterrupt()
+	{
+		Armed = false;
+		InSequence = false;
+	}
+
+	void ConfigureTimer(void (*callback)(void))
+	{
+		Callback = callback;
+	}
+
+	void AttachInterrupt()
+	{
+		Armed = false;
+		InSequence = false;
+	}
+
+	void InterruptAfterMicros(const uint32_t durationMicros)
+	{
+		if (durationMicros == Constants::PreambleInterval)
+		{
+			if (InSequence)
+			{
+				// Preamble in the middle of a sequence.
+				Violations++;
+			}
+			SequenceLength = 0;
+		}
+		else if (durationMicros != Constants::ZeroInterval
+			&& durationMicros != Constants::OneInterval
+#if defined(PIM_RATE_SWITCHING)
+			&& durationMicros != Constants::FastZeroInterval
+			&& durationMicros != Constants::FastOneInterval
+#endif
+			)
+		{
+			Violations++;
+		}
+
+		if (SequenceLength < SequenceSize)
+		{
+			Sequence[SequenceLength++] = durationMicros;
+		}
+		else
+		{
+			Violations++;
+		}
+
+		Deadline = micros() + durationMicros;
+		Armed = true;
+		InSequence = true;
+	}
+
+	void InterruptAfterOne()
+	{
+		InterruptAfterMicros(Constants::OneInterval);
+	}
+
+	void InterruptAfterZero()
+	{
+		InterruptAfterMicros(Constants::ZeroInterval);
+	}
+
+#if defined(PIM_RATE_SWITCHING)
+	void InterruptAfterFastOne()
+	{
+		InterruptAfterMicros(Constants::FastOneInterval);
+	}
+
+	void InterruptAfterFastZero()
+	{
+		InterruptAfterMicros(Constants::FastZeroInterval);
+	}
+#endif
+
+	void InterruptAfterPreamble()
+	{
+		InterruptAfterMicros(Constants::PreambleInterval);
+	}
+
+public:
+	const bool IsArmed() const
+	{
+		return Armed;
+	}
+
+	const uint32_t GetDeadline() const
+	{
+		return Deadline;
+	}
+
+	// Host tool calls this once the simulated time reaches the deadline.
+	void Fire()
+	{
+		if (Armed)
+		{
+			Armed = false;
+			if (Callback != nullptr)
+			{
+				Callback();
+			}
+		}
+	}
+
+	const uint32_t* GetSequence() const
+	{
+		return Sequence;
+	}
+
+	const uint16_t GetSequenceLength() const
+	{
+		return SequenceLength;
+	}
+
+	const uint32_t GetViolations() const
+	{
+		return Violations;
+	}
+};
 #endif
 #endif
\ No newline at end of file
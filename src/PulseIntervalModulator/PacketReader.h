@@ -2,11 +2,17 @@
 // Catches the pulse stream and builds up a packet buffer,
 // as long as the incoming bits are valid, otherwise it resets.
 // All work is done during interrupts.
+//
+// TemplatePacketReader takes the handler as a template parameter,
+// so OnPacketReceived/OnPacketLost are resolved at compile time and inlined into OnPulse.
+// PacketReader is the callback based reader, configured with PIM_USE_STATIC_CALLBACK.
 
 #ifndef _PIM_PACKET_READER_h
 #define _PIM_PACKET_READER_h
 
 #include "Constants.h"
+#include "HammingCode.h"
+#include "PulseTrace.h"
 #include <Arduino.h>
 
 
@@ -21,12 +27,58 @@ public:
 };
 #endif 
 
-class PacketReader
+#if defined(PIM_READER_STATS)
+struct PacketReaderStats
+{
+	uint32_t Received = 0;
+	uint32_t PreambleRejects = 0; // Start pulse not followed by a valid preamble.
+	uint32_t HeaderRejects = 0; // Invalid header bit interval.
+	uint32_t SizeRejects = 0; // Header size over the reader's maximum.
+	uint32_t DataRejects = 0; // Invalid data bit interval, packet lost.
+	uint32_t Timeouts = 0; // Truncated packet aborted by CheckTimeout().
+	uint32_t Glitches = 0; // Spurious pulses ignored by PIM_GLITCH_FILTER.
+	uint32_t CorrectedBits = 0; // Erased or flipped data bits recovered by PIM_FEC.
+	uint32_t Resyncs = 0; // Preambles found from an earlier start pulse by PIM_RESYNC.
+};
+#endif
+
+// Handler policy for TemplatePacketReader.
+// Derive and hide the calls of interest, unused ones compile away.
+// Calls are made during interrupts.
+class PacketReaderHandler
+{
+public:
+	// After the call, the buffer is considered free for the next incoming packet.
+	void OnPacketReceived(const uint32_t packetStartTimestamp) {}
+
+	void OnPacketLost(const uint32_t packetStartTimestamp) {}
+
+	// Each data byte, as soon as it's in the buffer.
+	void OnByteReceived(const PacketSizeType byteIndex, const PacketSizeType packetSize) {}
+
+#if defined(PIM_STREAMING)
+	// Each data byte, with the reader started without a buffer.
+	// OnPacketReceived commits the bytes so far, OnPacketLost aborts them.
+	void OnStreamByte(const PacketSizeType byteIndex, const uint8_t value) {}
+#endif
+
+#if defined(PIM_CSMA)
+	// A foreign pulse was read back while monitoring, the reader is back to blanking.
+	void OnCollision(const uint32_t timestamp) {}
+#endif
+};
+
+// Only one reader instance per HandlerType, as the pin interrupt is bound to a static instance.
+template<typename HandlerType>
+class TemplatePacketReader
 {
+private:
+	static TemplatePacketReader* Instance;
+
 private:
 	uint8_t* IncomingBuffer = nullptr;
-	uint8_t IncomingIndex = 0;
-	volatile uint8_t IncomingSize = 0;
+	PacketSizeType IncomingIndex = 0;
+	volatile PacketSizeType IncomingSize = 0;
 
 	uint8_t BitBuffer = 0;
 	uint8_t BitIndex = 0;
@@ -35,54 +87,96 @@ private:
 
 	volatile uint32_t LastTimeStamp = 0;
 
+#if defined(PIM_GLITCH_FILTER)
+	uint8_t GlitchCount = 0;
+#endif
+
+#if defined(PIM_RATE_SWITCHING)
+	// Payload rate of the current packet, from the header.
+	volatile bool FastRate = false;
+#endif
+
+#if defined(PIM_RESYNC)
+	// Recent pulses while looking for a packet, newest first, each may be a start pulse.
+	uint32_t ResyncCandidates[Constants::ResyncCandidates];
+	uint8_t ResyncCount = 0;
+
+	// Bit per candidate, set if it came after silence.
+	uint8_t ResyncSilences = 0;
+#endif
+
+#if defined(PIM_FEC)
+	// Code word in progress, erased bits are left clear.
+	uint16_t CodeWord = 0;
+	uint8_t Erasures[HammingCode::MaxErasures];
+	uint8_t ErasureCount = 0;
+#endif
+
+	// Values are fixed regardless of options, trace dumps refer to them.
 	enum StateEnum
 	{
-		Blanking,
-		BlankingWithPendingPacket,
-		WaitingForPreAmbleStart,
-		WaitingForPreAmbleEnd,
-		WaitingForHeaderEnd,
-		WaitingForDataBits,
-		WaitingForPacketClear,
+		Blanking = 0,
+		BlankingWithPendingPacket = 1,
+		WaitingForPreAmbleStart = 2,
+		WaitingForPreAmbleEnd = 3,
+		WaitingForHeaderEnd = 4,
+#if defined(PIM_EXTENDED_HEADER)
+		WaitingForExtendedSize = 5,
+#endif
+		WaitingForDataBits = 6,
+		WaitingForPacketClear = 7,
+		SkippingPacket = 8,
+#if defined(PIM_CSMA)
+		Monitoring = 9,
+		MonitoringWithPendingPacket = 10,
+#endif
 	};
 
 	volatile StateEnum State = StateEnum::Blanking;
 
-	const uint8_t MaxDataBytes = 0;
+	const PacketSizeType MaxDataBytes = 0;
 	const uint8_t ReadPin = 0;
 
-#if defined(PIM_USE_STATIC_CALLBACK)
-	void (*ReceiveCallback)(const uint32_t packetStartTimestamp) = nullptr;
-	void (*LostCallback)(const uint32_t packetStartTimestamp) = nullptr;
-#else
-	PacketReaderCallback* Callback = nullptr;
+	HandlerType Handler;
+
+#if defined(PIM_ADDRESS_FILTER)
+	uint8_t FilterAddress = 0;
+	uint8_t FilterMask = 0;
+	volatile uint16_t FilteredCount = 0;
+#endif
+
+#if defined(PIM_READER_STATS)
+	PacketReaderStats Stats;
+#endif
+
+#if defined(PIM_TRACE)
+	PulseTraceRing<Constants::TraceSize> TraceRing;
 #endif
 
 public:
-	PacketReader(uint8_t* incomingBuffer, const uint8_t maxDataBytes, const uint8_t readPin)
+	// With PIM_STREAMING, incomingBuffer can be nullptr, bytes go to the handler's OnStreamByte.
+	// maxDataBytes still bounds the accepted size.
+	TemplatePacketReader(const HandlerType& handler, uint8_t* incomingBuffer, const PacketSizeType maxDataBytes, const uint8_t readPin)
 		: IncomingBuffer(incomingBuffer)
 		, MaxDataBytes(maxDataBytes)
 		, ReadPin(readPin)
+		, Handler(handler)
 	{
 	}
 
-	void Start(
-#if defined(PIM_USE_STATIC_CALLBACK)
-		void (*receiveCallback)(const uint32_t packetStartTimestamp),
-		void (*lostCallback)(const uint32_t packetStartTimestamp))
+	HandlerType& GetHandler()
 	{
-		ReceiveCallback = receiveCallback;
-		LostCallback = lostCallback;
-#else
-		PacketReaderCallback* callback)
+		return Handler;
+	}
+
+	void Start()
 	{
-		Callback = callback;
-#endif
 		SetupInterrupt();
-		Start();
+		Resume();
 	}
 
-	void Start()
+private:
+	void Resume()
 	{
 		Attach();
 		State = StateEnum::WaitingForPreAmbleStart;
@@ -91,15 +185,22 @@ public:
 		IncomingSize = 0;
 	}
 
+public:
 	// Called after blanking or after consuming packet after OnPacketReceived.
 	void Restore()
 	{
 		switch (State)
 		{
 		case StateEnum::Blanking:
-			Start();
+#if defined(PIM_CSMA)
+		case StateEnum::Monitoring:
+#endif
+			Resume();
 			break;
 		case StateEnum::BlankingWithPendingPacket:
+#if defined(PIM_CSMA)
+		case StateEnum::MonitoringWithPendingPacket:
+#endif
 			if (IncomingSize > 0)
 			{
 				State = StateEnum::WaitingForPacketClear;
@@ -109,11 +210,37 @@ public:
 				State = StateEnum::WaitingForPreAmbleStart;
 			}
 		case StateEnum::WaitingForPacketClear:
-			Start();
+			Resume();
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Called after consuming the packet after OnPacketReceived, instead of Restore().
+	// A reader blanked or monitoring for a send started since stays so, until the writer's Restore().
+	void ClearPending()
+	{
+		noInterrupts();
+		switch (State)
+		{
+		case StateEnum::BlankingWithPendingPacket:
+			State = StateEnum::Blanking;
+			IncomingSize = 0;
+			break;
+#if defined(PIM_CSMA)
+		case StateEnum::MonitoringWithPendingPacket:
+			State = StateEnum::Monitoring;
+			IncomingSize = 0;
+			break;
+#endif
+		case StateEnum::WaitingForPacketClear:
+			Resume();
 			break;
 		default:
 			break;
 		}
+		interrupts();
 	}
 
 	void Stop()
@@ -126,7 +253,11 @@ public:
 	{
 		Detach();
 
-		if (State == StateEnum::WaitingForPacketClear)
+		if (State == StateEnum::WaitingForPacketClear
+#if defined(PIM_CSMA)
+			|| State == StateEnum::MonitoringWithPendingPacket
+#endif
+			)
 		{
 			State = StateEnum::BlankingWithPendingPacket;
 		}
@@ -136,11 +267,35 @@ public:
 		}
 	}
 
-	const bool HasIncoming(uint8_t & incomingSize)
+#if defined(PIM_CSMA)
+	// Blanks receiving while sending, but keeps checking the pulses read back.
+	// Own pulses are never closer than MonitorIntervalMin,
+	// a closer pair means another node is sending too, and OnCollision is called.
+	void Monitor()
+	{
+		if (State == StateEnum::WaitingForPacketClear)
+		{
+			State = StateEnum::MonitoringWithPendingPacket;
+		}
+		else
+		{
+			State = StateEnum::Monitoring;
+		}
+
+		// BitIndex flags the first pulse.
+		BitIndex = 0;
+		Attach();
+	}
+#endif
+
+	const bool HasIncoming(PacketSizeType& incomingSize)
 	{
 		switch (State)
 		{
 		case StateEnum::BlankingWithPendingPacket:
+#if defined(PIM_CSMA)
+		case StateEnum::MonitoringWithPendingPacket:
+#endif
 		case StateEnum::WaitingForPacketClear:
 			incomingSize = IncomingSize;
 			return incomingSize > 0;
@@ -157,6 +312,10 @@ public:
 		{
 		case StateEnum::Blanking:
 		case StateEnum::BlankingWithPendingPacket:
+#if defined(PIM_CSMA)
+		case StateEnum::Monitoring:
+		case StateEnum::MonitoringWithPendingPacket:
+#endif
 			return true;
 		default:
 			return false;
@@ -168,8 +327,128 @@ public:
 		return LastTimeStamp;
 	}
 
+#if defined(PIM_RATE_SWITCHING)
+	// Payload rate of the last packet, valid once its header is in.
+	const bool IsFastRate()
+	{
+		return FastRate;
+	}
+#endif
+
+#if defined(PIM_READER_STATS)
+	void GetStats(PacketReaderStats& stats)
+	{
+		noInterrupts();
+		stats = Stats;
+		interrupts();
+	}
+
+	void ClearStats()
+	{
+		noInterrupts();
+		Stats = PacketReaderStats();
+		interrupts();
+	}
+#endif
+
+#if defined(PIM_TRACE)
+	// Stops recording, the ring keeps the last pulses. Also done on packet loss.
+	void FreezeTrace()
+	{
+		TraceRing.Freeze();
+	}
+
+	void ResumeTrace()
+	{
+		TraceRing.Resume();
+	}
+
+	// Freeze before reading.
+	const PulseTraceRing<Constants::TraceSize>& GetTrace()
+	{
+		return TraceRing;
+	}
+#endif
+
+#if defined(PIM_ADDRESS_FILTER)
+	// Packets are accepted when (firstByte & mask) == (address & mask).
+	// A zero mask accepts all packets.
+	void SetAddressFilter(const uint8_t address, const uint8_t mask)
+	{
+		noInterrupts();
+		FilterAddress = address;
+		FilterMask = mask;
+		interrupts();
+	}
+
+	// Packets dropped by the address filter.
+	const uint16_t GetFilteredCount()
+	{
+		noInterrupts();
+		const uint16_t filteredCount = FilteredCount;
+		interrupts();
+
+		return filteredCount;
+	}
+#endif
+
+#if defined(PIM_SILENCE_TIMEOUT)
+	// Aborts an in-progress packet once no pulse has come for SilenceTimeoutInterval,
+	// instead of waiting for the next pulse. Frees the buffer and reports the loss right away.
+	// Cheap enough to poll from the main loop.
+	// Returns true if a packet was lost.
+	const bool CheckTimeout()
+	{
+		bool lost = false;
+
+		noInterrupts();
+		switch (State)
+		{
+		case StateEnum::WaitingForHeaderEnd:
+#if defined(PIM_EXTENDED_HEADER)
+		case StateEnum::WaitingForExtendedSize:
+#endif
+		case StateEnum::WaitingForDataBits:
+		case StateEnum::SkippingPacket:
+			if (micros() - BitTimestamp > Constants::SilenceTimeoutInterval)
+			{
+				// Only packets past the header are reported, same as in OnPulse.
+				lost = State == StateEnum::WaitingForDataBits;
+
+#if defined(PIM_TRACE)
+				TraceRing.Record(micros(), State, TraceTimeout);
+				if (lost)
+				{
+					TraceRing.Freeze();
+				}
+#endif
+				IncomingSize = 0;
+				State = StateEnum::WaitingForPreAmbleStart;
+#if defined(PIM_READER_STATS)
+				Stats.Timeouts++;
+#endif
+
+				// Reported with interrupts disabled, same context as from OnPulse.
+				if (lost)
+				{
+					Handler.OnPacketLost(PacketStartTimestamp);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+		interrupts();
+
+		return lost;
+	}
+#endif
+
 	void OnPulse()
 	{
+#if defined(PIM_RESYNC)
+		const uint32_t previousTimeStamp = LastTimeStamp;
+#endif
 		LastTimeStamp = micros();
 		bool bit = false;
 		switch (State)
@@ -180,148 +459,457 @@ public:
 			// Ignore.
 			break;
 		case StateEnum::WaitingForPreAmbleStart:
+			Trace(TraceStart);
+#if defined(PIM_RESYNC)
+			// After a header timeout, a recent pulse may still be the start pulse.
+			Restart();
+#else
 			PacketStartTimestamp = LastTimeStamp;
 			State = StateEnum::WaitingForPreAmbleEnd;
+#endif
 			break;
 		case StateEnum::WaitingForPreAmbleEnd:
 			if (ValidatePreamble(LastTimeStamp - PacketStartTimestamp))
 			{
-				// Preamble header detected.
-				BitTimestamp = LastTimeStamp;
-
-				// Take this time to reset the incoming buffer.
-				IncomingIndex = 0;
-				IncomingSize = 0;
-				BitIndex = 0;
-
-				State = StateEnum::WaitingForHeaderEnd;
+				Trace(TracePreamble);
+				OnPreamble();
 			}
 			else
 			{
-				// Restart assuming the last pulse was a start pulse.
-				PacketStartTimestamp = LastTimeStamp;
-				State = StateEnum::WaitingForPreAmbleEnd;
+				Trace(TracePreambleReject);
+#if defined(PIM_READER_STATS)
+				Stats.PreambleRejects++;
+#endif
+				Restart();
 			}
 			break;
 		case StateEnum::WaitingForHeaderEnd:
+#if defined(PIM_GLITCH_FILTER)
+			if (IsGlitch())
+			{
+				break;
+			}
+#endif
 			if (DecodeBit(LastTimeStamp - BitTimestamp, bit))
 			{
+				Trace(bit ? TraceOne : TraceZero);
 				BitTimestamp = LastTimeStamp;
 
 				// Header bits come in MSB first.
-				IncomingSize += (bit << (Constants::HeaderBits - 1 - BitIndex));
+				IncomingSize += (bit << (Constants::HeaderFieldBits - 1 - BitIndex));
 				BitIndex++;
 
-				if (BitIndex > (Constants::HeaderBits - 1))
+				if (BitIndex > (Constants::HeaderFieldBits - 1))
 				{
-					// Add one, according to specification.
-					IncomingSize += Constants::MinDataBytes;
-
-					if (IncomingSize > MaxDataBytes) {
-						// Invalid packet size.
-						// Restart assuming the last pulse was a start pulse.
-						PacketStartTimestamp = LastTimeStamp;
-						State = StateEnum::WaitingForPreAmbleEnd;
-					}
-					else
+#if defined(PIM_RATE_SWITCHING)
+					// Rate bit is last, payload switches once the header is done.
+					FastRate = IncomingSize & 0x01;
+					IncomingSize >>= Constants::RateBits;
+#endif
+#if defined(PIM_EXTENDED_HEADER)
+					if (IncomingSize == Constants::HeaderEscape)
 					{
-						// Packet size has been read, wait for data bits.
+						// Extended size follows.
+						IncomingSize = 0;
 						BitBuffer = 0;
 						BitIndex = 0;
-						State = StateEnum::WaitingForDataBits;
+						State = StateEnum::WaitingForExtendedSize;
+						break;
 					}
+#endif
+					// Add one, according to specification.
+					IncomingSize += Constants::MinDataBytes;
+					OnSizeComplete();
 				}
 			}
 			else
 			{
-				// Restart assuming the last pulse was a start pulse.
-				PacketStartTimestamp = LastTimeStamp;
-				State = StateEnum::WaitingForPreAmbleEnd;
+				Trace(TraceHeaderReject);
+#if defined(PIM_READER_STATS)
+				Stats.HeaderRejects++;
+#endif
+				Restart();
 			}
 			break;
-		case StateEnum::WaitingForDataBits:
+#if defined(PIM_EXTENDED_HEADER)
+		case StateEnum::WaitingForExtendedSize:
+#if defined(PIM_GLITCH_FILTER)
+			if (IsGlitch())
+			{
+				break;
+			}
+#endif
 			if (DecodeBit(LastTimeStamp - BitTimestamp, bit))
 			{
+				Trace(bit ? TraceOne : TraceZero);
 				BitTimestamp = LastTimeStamp;
 
-				// Data bits come in MSB.
 				BitBuffer += (bit << (7 - BitIndex));
 				BitIndex++;
 
 				if (BitIndex > 7)
 				{
-					IncomingBuffer[IncomingIndex++] = BitBuffer;
+					if (IncomingSize > ((MaxDataBytes - Constants::ExtendedBaseBytes) >> Constants::ExtendedGroupBits))
+					{
+						// Too many groups, over any valid size.
+						RejectSize();
+						break;
+					}
+
+					IncomingSize = (IncomingSize << Constants::ExtendedGroupBits) | (BitBuffer & 0x7F);
 
-					if (IncomingIndex > (IncomingSize - 1))
+					if (BitBuffer & 0x80)
 					{
-						Detach();
-						State = StateEnum::WaitingForPacketClear;
-#if defined(PIM_USE_STATIC_CALLBACK)
-#if defined(PIM_SAFETY_CHECKS)
-						if (ReceiveCallback != nullptr)
+						// Another group follows.
+						BitBuffer = 0;
+						BitIndex = 0;
+					}
+					else
+					{
+						IncomingSize += Constants::ExtendedBaseBytes;
+						OnSizeComplete();
+					}
+				}
+			}
+			else
+			{
+				Trace(TraceHeaderReject);
+#if defined(PIM_READER_STATS)
+				Stats.HeaderRejects++;
 #endif
-						{
-							ReceiveCallback(PacketStartTimestamp);
-						}
-#else
-#if defined(PIM_SAFETY_CHECKS)
-						if (Callback != nullptr)
+				Restart();
+			}
+			break;
 #endif
-						{
-							Callback->OnPacketReceived(PacketStartTimestamp);
-						}
+		case StateEnum::WaitingForDataBits:
+#if defined(PIM_GLITCH_FILTER)
+			if (IsGlitch())
+			{
+				break;
+			}
 #endif
+#if defined(PIM_FEC)
+			if (DecodeCodeBit(LastTimeStamp - BitTimestamp))
+			{
+				BitTimestamp = LastTimeStamp;
+
+				if (BitIndex > (HammingCode::CodeBits - 1))
+				{
+					if (CorrectCodeWord())
+					{
+						OnDataByte();
 					}
 					else
 					{
-						BitBuffer = 0;
-						BitIndex = 0;
+						OnDataReject();
 					}
 				}
 			}
-			else
+#else
+			if (DecodeDataBit(LastTimeStamp - BitTimestamp, bit))
 			{
-				// Using BitTimestamp as copy, just for the event.
-				BitTimestamp = PacketStartTimestamp;
+				Trace(bit ? TraceOne : TraceZero);
+				BitTimestamp = LastTimeStamp;
+
+				// Data bits come in MSB.
+				BitBuffer += (bit << (7 - BitIndex));
+				BitIndex++;
 
-				// Restart assuming the last pulse was a start pulse.
+				if (BitIndex > 7)
+				{
+					OnDataByte();
+				}
+			}
+#endif
+			else
+			{
+				OnDataReject();
+			}
+			break;
+		case StateEnum::SkippingPacket:
+			if (LastTimeStamp - BitTimestamp > Constants::SilenceTimeoutInterval)
+			{
+				// Silence after the skipped packet, this is a start pulse.
+				Trace(TraceStart);
 				PacketStartTimestamp = LastTimeStamp;
 				State = StateEnum::WaitingForPreAmbleEnd;
+			}
+			else
+			{
+				Trace(TraceSkipped);
+				BitTimestamp = LastTimeStamp;
+			}
+			break;
+#if defined(PIM_CSMA)
+		case StateEnum::Monitoring:
+		case StateEnum::MonitoringWithPendingPacket:
+			if (BitIndex > 0
+				&& (LastTimeStamp - BitTimestamp) < Constants::MonitorIntervalMin)
+			{
+				// Report once, the driver aborts the packet.
+				Trace(TraceCollision);
+				Detach();
+				State = (State == StateEnum::MonitoringWithPendingPacket) ? StateEnum::BlankingWithPendingPacket : StateEnum::Blanking;
+				Handler.OnCollision(LastTimeStamp);
+			}
+			else
+			{
+				Trace(TraceEcho);
+				BitIndex = 1;
+				BitTimestamp = LastTimeStamp;
+			}
+			break;
+#endif
+		default:
+			break;
+		}
 
-				// Let the Driver know we dropped a packet.
-#if defined(PIM_USE_STATIC_CALLBACK)
-#if defined(PIM_SAFETY_CHECKS)
-				if (LostCallback != nullptr)
+#if defined(PIM_RESYNC)
+		AddResyncCandidate((LastTimeStamp - previousTimeStamp) > Constants::SilenceTimeoutInterval);
 #endif
-				{
-					LostCallback(BitTimestamp);
-				}
-#else
-#if defined(PIM_SAFETY_CHECKS)
-				if (Callback != nullptr)
+	}
+
+private:
+	// Preamble ends on the last pulse, header bits follow.
+	void OnPreamble()
+	{
+		BitTimestamp = LastTimeStamp;
+
+		// Take this time to reset the incoming buffer.
+		IncomingIndex = 0;
+		IncomingSize = 0;
+		BitIndex = 0;
+#if defined(PIM_GLITCH_FILTER)
+		GlitchCount = 0;
 #endif
-				{
-					Callback->OnPacketLost(BitTimestamp);
-				}
+#if defined(PIM_RATE_SWITCHING)
+		FastRate = false;
 #endif
+
+		State = StateEnum::WaitingForHeaderEnd;
+	}
+
+	// Restart assuming the last pulse was a start pulse.
+	// With PIM_RESYNC, a recent pulse may have been the start pulse and the last one its preamble end.
+	// Skipping pulses takes a gap too short for a bit between the candidates, and silence before the start pulse,
+	// as a run of bits can add up to a preamble.
+	void Restart()
+	{
+#if defined(PIM_RESYNC)
+		bool glitch = false;
+		for (uint8_t i = 0; i < ResyncCount; i++)
+		{
+			if (i > 0)
+			{
+				glitch |= (ResyncCandidates[i - 1] - ResyncCandidates[i]) <= Constants::ZeroIntervalMin;
+			}
+
+			if ((i == 0 || (glitch && ((ResyncSilences >> i) & 0x01)))
+				&& ValidatePreamble(LastTimeStamp - ResyncCandidates[i]))
+			{
+				Trace(TraceResync);
+				PacketStartTimestamp = ResyncCandidates[i];
+#if defined(PIM_READER_STATS)
+				Stats.Resyncs++;
+#endif
+				OnPreamble();
+				return;
+			}
+		}
+#endif
+		PacketStartTimestamp = LastTimeStamp;
+		State = StateEnum::WaitingForPreAmbleEnd;
+	}
+
+#if defined(PIM_RESYNC)
+	// Pulses while looking for a preamble or header are kept for Restart().
+	void AddResyncCandidate(const bool afterSilence)
+	{
+		switch (State)
+		{
+		case StateEnum::WaitingForPreAmbleEnd:
+		case StateEnum::WaitingForHeaderEnd:
+#if defined(PIM_EXTENDED_HEADER)
+		case StateEnum::WaitingForExtendedSize:
+#endif
+			for (uint8_t i = Constants::ResyncCandidates - 1; i > 0; i--)
+			{
+				ResyncCandidates[i] = ResyncCandidates[i - 1];
+			}
+			ResyncCandidates[0] = LastTimeStamp;
+			ResyncSilences = (ResyncSilences << 1) | afterSilence;
+			if (ResyncCount < Constants::ResyncCandidates)
+			{
+				ResyncCount++;
 			}
 			break;
 		default:
+			// Past the header or not reading, the candidates are stale.
+			ResyncCount = 0;
 			break;
 		}
 	}
+#endif
 
-private:
-	// Defined in cpp.
-	void Attach();
-	void SetupInterrupt();
+	// Packet size is known, check it against the buffer.
+	void OnSizeComplete()
+	{
+		if (IncomingSize > MaxDataBytes)
+		{
+			RejectSize();
+		}
+		else
+		{
+			// Packet size has been read, wait for data bits.
+			ClearDataByte();
+			State = StateEnum::WaitingForDataBits;
+		}
+	}
+
+	// A data byte is complete in BitBuffer.
+	void OnDataByte()
+	{
+#if defined(PIM_ADDRESS_FILTER)
+		if (IncomingIndex == 0
+			&& ((BitBuffer ^ FilterAddress) & FilterMask) != 0)
+		{
+			// Not for us, skip the rest without buffering or raising callbacks.
+			Trace(TraceFiltered);
+			FilteredCount++;
+			State = StateEnum::SkippingPacket;
+			return;
+		}
+#endif
+#if defined(PIM_STREAMING)
+		if (IncomingBuffer == nullptr)
+		{
+			Handler.OnStreamByte(IncomingIndex, BitBuffer);
+		}
+		else
+#endif
+		{
+			IncomingBuffer[IncomingIndex] = BitBuffer;
+		}
+		IncomingIndex++;
+		Handler.OnByteReceived(IncomingIndex - 1, IncomingSize);
+
+		if (IncomingIndex > (IncomingSize - 1))
+		{
+			Trace(TraceReceived);
+			Detach();
+			State = StateEnum::WaitingForPacketClear;
+#if defined(PIM_READER_STATS)
+			Stats.Received++;
+#endif
+			Handler.OnPacketReceived(PacketStartTimestamp);
+		}
+		else
+		{
+			ClearDataByte();
+		}
+	}
+
+	void ClearDataByte()
+	{
+		BitBuffer = 0;
+		BitIndex = 0;
+#if defined(PIM_FEC)
+		CodeWord = 0;
+		ErasureCount = 0;
+#endif
+	}
+
+	// Invalid data, the packet is lost.
+	void OnDataReject()
+	{
+		Trace(TraceDataReject);
+#if defined(PIM_TRACE)
+		// Keep the pulses that led to the loss.
+		TraceRing.Freeze();
+#endif
+
+		// Using BitTimestamp as copy, just for the event.
+		BitTimestamp = PacketStartTimestamp;
+
+		// Restart assuming the last pulse was a start pulse.
+		PacketStartTimestamp = LastTimeStamp;
+		State = StateEnum::WaitingForPreAmbleEnd;
+
+#if defined(PIM_READER_STATS)
+		Stats.DataRejects++;
+#endif
+
+		// Let the Driver know we dropped a packet.
+		Handler.OnPacketLost(BitTimestamp);
+	}
+
+	void RejectSize()
+	{
+		Trace(TraceSizeReject);
+
+		// Invalid packet size.
+#if defined(PIM_READER_STATS)
+		Stats.SizeRejects++;
+#endif
+		Restart();
+	}
+
+	// Compiles away without PIM_TRACE.
+	void Trace(const PulseTraceVerdict verdict)
+	{
+#if defined(PIM_TRACE)
+		TraceRing.Record(LastTimeStamp, State, verdict);
+#endif
+	}
+
+	static void OnPulseInterrupt()
+	{
+		Instance->OnPulse();
+	}
+
+	void SetupInterrupt()
+	{
+		Instance = this;
+		pinMode(ReadPin, INPUT);
+	}
+
+	void Attach()
+	{
+		attachInterrupt(digitalPinToInterrupt(ReadPin), OnPulseInterrupt, RISING);
+	}
 
 	void Detach()
 	{
 		detachInterrupt(digitalPinToInterrupt(ReadPin));
 	}
 
-private:
+#if defined(PIM_GLITCH_FILTER)
+	// A pulse too soon after the last bit can't be a bit, ignore it while the budget lasts.
+	// BitTimestamp is kept, so the next real pulse still decodes.
+	const bool IsGlitch()
+	{
+#if defined(PIM_RATE_SWITCHING)
+		const uint32_t minimum = (FastRate && State == StateEnum::WaitingForDataBits) ? Constants::FastZeroIntervalMin : Constants::ZeroIntervalMin;
+#else
+		const uint32_t minimum = Constants::ZeroIntervalMin;
+#endif
+		if ((LastTimeStamp - BitTimestamp) <= minimum
+			&& GlitchCount < Constants::GlitchBudget)
+		{
+			GlitchCount++;
+			Trace(TraceGlitch);
+#if defined(PIM_READER_STATS)
+			Stats.Glitches++;
+#endif
+			return true;
+		}
+
+		return false;
+	}
+#endif
+
+protected:
+	// Stateless, exposed to subclasses so host tools can measure them in isolation.
 	const bool ValidatePreamble(const uint32_t pulseDuration)
 	{
 		return (pulseDuration < Constants::PreambleIntervalMax) &&
@@ -346,5 +934,173 @@ private:
 		// Invalid bit pulse interval.
 		return false;
 	}
+
+#if defined(PIM_RATE_SWITCHING)
+	const bool DecodeFastBit(const uint32_t pulseSeparation, bool& bit)
+	{
+		if (pulseSeparation < Constants::FastOneIntervalMax)
+		{
+			if (pulseSeparation > Constants::FastOneIntervalMin) {
+				bit = true;
+				return true;
+			}
+			else if (pulseSeparation > Constants::FastZeroIntervalMin)
+			{
+				bit = false;
+				return true;
+			}
+		}
+
+		// Invalid bit pulse interval.
+		return false;
+	}
+#endif
+
+private:
+	// Payload bits use the packet's rate.
+	const bool DecodeDataBit(const uint32_t pulseSeparation, bool& bit)
+	{
+#if defined(PIM_RATE_SWITCHING)
+		if (FastRate)
+		{
+			return DecodeFastBit(pulseSeparation, bit);
+		}
+#endif
+		return DecodeBit(pulseSeparation, bit);
+	}
+
+#if defined(PIM_FEC)
+	// Adds a bit to the code word, or marks it as erased if the pulse is out of window.
+	// Returns false once the word has more erasures than the code can fill in.
+	const bool DecodeCodeBit(const uint32_t pulseSeparation)
+	{
+		bool bit = false;
+		if (DecodeDataBit(pulseSeparation, bit))
+		{
+			Trace(bit ? TraceOne : TraceZero);
+			CodeWord |= (uint16_t)bit << (HammingCode::CodeBits - 1 - BitIndex);
+		}
+		else if (ErasureCount < HammingCode::MaxErasures
+			&& pulseSeparation < GetErasureIntervalMax())
+		{
+			// Bit is left clear, the decoder fills it in.
+			Trace(TraceErasure);
+			Erasures[ErasureCount++] = HammingCode::CodeBits - 1 - BitIndex;
+		}
+		else
+		{
+			return false;
+		}
+		BitIndex++;
+
+		return true;
+	}
+
+	const uint32_t GetErasureIntervalMax()
+	{
+#if defined(PIM_RATE_SWITCHING)
+		if (FastRate)
+		{
+			return Constants::FastErasureIntervalMax;
+		}
+#endif
+		return Constants::ErasureIntervalMax;
+	}
+
+	// Decodes the complete code word into BitBuffer.
+	const bool CorrectCodeWord()
+	{
+		uint8_t correctedBits = 0;
+		if (HammingCode::Decode(CodeWord, Erasures, ErasureCount, BitBuffer, correctedBits))
+		{
+#if defined(PIM_READER_STATS)
+			Stats.CorrectedBits += correctedBits;
+#endif
+			return true;
+		}
+
+		return false;
+	}
+#endif
+};
+
+template<typename HandlerType>
+TemplatePacketReader<HandlerType>* TemplatePacketReader<HandlerType>::Instance = nullptr;
+
+// Forwards to the callbacks set on Start.
+class CallbackReaderHandler : public PacketReaderHandler
+{
+public:
+#if defined(PIM_USE_STATIC_CALLBACK)
+	void (*ReceiveCallback)(const uint32_t packetStartTimestamp) = nullptr;
+	void (*LostCallback)(const uint32_t packetStartTimestamp) = nullptr;
+#else
+	PacketReaderCallback* Callback = nullptr;
+#endif
+
+public:
+	void OnPacketReceived(const uint32_t packetStartTimestamp)
+	{
+#if defined(PIM_USE_STATIC_CALLBACK)
+#if defined(PIM_SAFETY_CHECKS)
+		if (ReceiveCallback != nullptr)
+#endif
+		{
+			ReceiveCallback(packetStartTimestamp);
+		}
+#else
+#if defined(PIM_SAFETY_CHECKS)
+		if (Callback != nullptr)
+#endif
+		{
+			Callback->OnPacketReceived(packetStartTimestamp);
+		}
+#endif
+	}
+
+	void OnPacketLost(const uint32_t packetStartTimestamp)
+	{
+#if defined(PIM_USE_STATIC_CALLBACK)
+#if defined(PIM_SAFETY_CHECKS)
+		if (LostCallback != nullptr)
+#endif
+		{
+			LostCallback(packetStartTimestamp);
+		}
+#else
+#if defined(PIM_SAFETY_CHECKS)
+		if (Callback != nullptr)
+#endif
+		{
+			Callback->OnPacketLost(packetStartTimestamp);
+		}
+#endif
+	}
+};
+
+class PacketReader : public TemplatePacketReader<CallbackReaderHandler>
+{
+public:
+	PacketReader(uint8_t* incomingBuffer, const PacketSizeType maxDataBytes, const uint8_t readPin)
+		: TemplatePacketReader<CallbackReaderHandler>(CallbackReaderHandler(), incomingBuffer, maxDataBytes, readPin)
+	{
+	}
+
+	using TemplatePacketReader<CallbackReaderHandler>::Start;
+
+	void Start(
+#if defined(PIM_USE_STATIC_CALLBACK)
+		void (*receiveCallback)(const uint32_t packetStartTimestamp),
+		void (*lostCallback)(const uint32_t packetStartTimestamp))
+	{
+		GetHandler().ReceiveCallback = receiveCallback;
+		GetHandler().LostCallback = lostCallback;
+#else
+		PacketReaderCallback* callback)
+	{
+		GetHandler().Callback = callback;
+#endif
+		Start();
+	}
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,218 @@
+// PacketRepeater.h
+// Cut-through repeater, links a reader to a writer on another pin.
+// The writer starts re-emitting the packet as soon as LeadBytes data bytes are in,
+// reading straight from the reader's buffer, instead of waiting for the whole packet.
+// Per-hop latency is the preamble, header and LeadBytes, instead of the full packet.
+// If the inbound packet is lost, or the writer catches up with the reader,
+// the outbound packet is aborted and the next hop sees it truncated.
+// All work is done during interrupts.
+//
+// The writer stays behind the reader by preamble + header + LeadBytes,
+// the inbound link must leave at least that much silence between packets.
+// One LeadByte is enough for the default timing profile, with its tolerance.
+
+#ifndef _PIM_PACKET_REPEATER_h
+#define _PIM_PACKET_REPEATER_h
+
+#include "PacketReader.h"
+#include "PacketWriter.h"
+
+template<const PacketSizeType MaxPacketSize, const uint8_t LeadBytes = 1>
+class PacketRepeater
+{
+private:
+	static_assert(LeadBytes >= 1, "LeadBytes must be at least 1.");
+
+	class RepeaterReaderHandler : public PacketReaderHandler
+	{
+	private:
+		PacketRepeater* Repeater;
+
+	public:
+		RepeaterReaderHandler(PacketRepeater* repeater) : Repeater(repeater) {}
+
+		void OnByteReceived(const PacketSizeType byteIndex, const PacketSizeType packetSize)
+		{
+			Repeater->OnByteReceived(byteIndex, packetSize);
+		}
+
+		void OnPacketReceived(const uint32_t startTimestamp)
+		{
+			Repeater->OnPacketReceived();
+		}
+
+		void OnPacketLost(const uint32_t startTimestamp)
+		{
+			Repeater->OnPacketLost();
+		}
+	};
+
+	class RepeaterWriterHandler : public PacketWriterHandler
+	{
+	private:
+		PacketRepeater* Repeater;
+
+	public:
+		RepeaterWriterHandler(PacketRepeater* repeater) : Repeater(repeater) {}
+
+		void OnPacketSent()
+		{
+			Repeater->OnPacketSent();
+		}
+
+		const bool CanWriteByte(const PacketSizeType byteIndex)
+		{
+			return Repeater->CanWriteByte(byteIndex);
+		}
+	};
+
+	uint8_t Buffer[MaxPacketSize];
+
+	TemplatePacketReader<RepeaterReaderHandler> Reader;
+	TemplatePacketWriter<RepeaterWriterHandler> Writer;
+
+	volatile PacketSizeType ReceivedBytes = 0;
+	volatile bool Forwarding = false;
+
+	volatile uint16_t ForwardedCount = 0;
+	volatile uint16_t AbortedCount = 0;
+
+public:
+#if defined(ARDUINO_ARCH_AVR) || defined(PIM_HOST)
+	PacketRepeater(const uint8_t readPin, const uint8_t writePin)
+#elif defined(ARDUINO_ARCH_STM32F1)
+	PacketRepeater(const uint8_t readPin, const uint8_t writePin, const uint8_t timerIndex, const uint8_t timerChannel)
+#endif
+		: Reader(RepeaterReaderHandler(this), Buffer, MaxPacketSize, readPin)
+#if defined(ARDUINO_ARCH_AVR) || defined(PIM_HOST)
+		, Writer(RepeaterWriterHandler(this), MaxPacketSize, writePin)
+#elif defined(ARDUINO_ARCH_STM32F1)
+		, Writer(RepeaterWriterHandler(this), MaxPacketSize, writePin, timerIndex, timerChannel)
+#endif
+	{
+	}
+
+	void Start()
+	{
+		Forwarding = false;
+		Reader.Start();
+		Writer.Start();
+	}
+
+	void Stop()
+	{
+		Reader.Stop();
+		Writer.Stop();
+		Forwarding = false;
+	}
+
+	// Packets fully forwarded.
+	const uint16_t GetForwardedCount()
+	{
+		noInterrupts();
+		const uint16_t forwardedCount = ForwardedCount;
+		interrupts();
+
+		return forwardedCount;
+	}
+
+	// Packets aborted mid-way, on inbound loss or writer underrun.
+	const uint16_t GetAbortedCount()
+	{
+		noInterrupts();
+		const uint16_t abortedCount = AbortedCount;
+		interrupts();
+
+		return abortedCount;
+	}
+
+#if defined(PIM_SILENCE_TIMEOUT)
+	// Aborts the outbound packet right away if the inbound one was truncated.
+	void CheckTimeout()
+	{
+		Reader.CheckTimeout();
+	}
+#endif
+
+#if defined(PIM_HOST)
+	// Host tools drive the reader and the mock timer directly.
+	TemplatePacketReader<RepeaterReaderHandler>& GetReader()
+	{
+		return Reader;
+	}
+
+	TemplatePacketWriter<RepeaterWriterHandler>& GetWriter()
+	{
+		return Writer;
+	}
+#endif
+
+private:
+	// Interrupt handlers.
+	void OnByteReceived(const PacketSizeType byteIndex, const PacketSizeType packetSize)
+	{
+		ReceivedBytes = byteIndex + 1;
+
+		if (!Forwarding
+			&& (ReceivedBytes == LeadBytes || ReceivedBytes == packetSize))
+		{
+			Forwarding = true;
+#if defined(PIM_RATE_SWITCHING)
+			// Forward at the inbound rate.
+			Writer.SetFastRate(Reader.IsFastRate());
+#endif
+			Writer.SendPacket(Buffer, packetSize);
+		}
+	}
+
+	void OnPacketReceived()
+	{
+		// The writer still owns the buffer until it's done.
+		if (!Forwarding)
+		{
+			Reader.Restore();
+		}
+	}
+
+	void OnPacketLost()
+	{
+		if (Forwarding)
+		{
+			Abort();
+		}
+	}
+
+	void OnPacketSent()
+	{
+		Forwarding = false;
+		ForwardedCount++;
+
+		// Buffer is free, resume receiving.
+		Reader.Restore();
+	}
+
+	const bool CanWriteByte(const PacketSizeType byteIndex)
+	{
+		if (byteIndex < ReceivedBytes)
+		{
+			return true;
+		}
+
+		// Writer caught up with the reader, the writer stops itself.
+		Forwarding = false;
+		AbortedCount++;
+
+		// The inbound packet can't be forwarded anymore, release it if it's complete.
+		Reader.Restore();
+
+		return false;
+	}
+
+	void Abort()
+	{
+		Writer.Stop();
+		Forwarding = false;
+		AbortedCount++;
+	}
+};
+#endif
\ No newline at end of file
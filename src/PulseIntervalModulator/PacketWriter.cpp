@@ -4,26 +4,17 @@
 
 #include "PacketWriter.h"
 
-PacketWriter* PulseIntervalModulatorWriter = nullptr;
-
 #if defined(ARDUINO_ARCH_AVR)
-ISR(TIMER0_COMPA_vect)
-{
-	PulseIntervalModulatorWriter->OnWriterInterrupt();
-}
-
-void PacketWriter::SetupInterrupt()
-{
-	PulseIntervalModulatorWriter = this;
-}
-#elif defined(ARDUINO_ARCH_STM32F1)
-void OnWriterTimerInterrupt()
-{
-	PulseIntervalModulatorWriter->OnWriterInterrupt();
-}
+void (*PulseIntervalModulatorWriterInterrupt)(void) = nullptr;
 
-void PacketWriter::SetupInterrupt()
+#if (PIM_AVR_WRITER_TIMER == 1)
+ISR(TIMER1_COMPA_vect)
+#elif (PIM_AVR_WRITER_TIMER == 2)
+ISR(TIMER2_COMPA_vect)
+#else
+ISR(TIMER0_COMPA_vect)
+#endif
 {
-	TimerWrapper.ConfigureTimer(OnWriterTimerInterrupt);
+	PulseIntervalModulatorWriterInterrupt();
 }
 #endif
\ No newline at end of file
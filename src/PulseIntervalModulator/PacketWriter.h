@@ -2,7 +2,12 @@
 // Bit bangs out the packets using rolling Timer0 interrupts on Channel A.
 // Channel B is still free.
 // Does not affect millis(), micros() or delay().
+// On AVR, Timer1 or Timer2 can be used instead, see PIM_AVR_WRITER_TIMER.
 // All work is done during interrupts.
+//
+// TemplatePacketWriter takes the handler as a template parameter,
+// so OnPacketSent is resolved at compile time and inlined into OnWriterInterrupt.
+// PacketWriter is the callback based writer, configured with PIM_USE_STATIC_CALLBACK.
 #ifndef _PIM_PACKET_WRITER_h
 #define _PIM_PACKET_WRITER_h
 
@@ -16,6 +21,8 @@
 #endif
 
 #include "InterruptTimerWrapper.h"
+#include "HammingCode.h"
+#include "PulseTrace.h"
 
 #if !defined(PIM_USE_STATIC_CALLBACK)
 class PacketWriterCallback
@@ -25,8 +32,44 @@ public:
 };
 #endif 
 
-class PacketWriter
+// Handler policy for TemplatePacketWriter.
+// Derive and hide the calls of interest, unused ones compile away.
+// Calls are made during interrupts.
+class PacketWriterHandler
 {
+public:
+	void OnPacketSent() {}
+
+	// Asked before each data byte is written out.
+	// Returning false aborts the packet, the receiver sees it truncated.
+	const bool CanWriteByte(const PacketSizeType byteIndex) { return true; }
+
+#if defined(PIM_STREAMING)
+	// Data byte for SendStream(), asked while the previous byte is going out.
+	// The first one is asked from SendStream() itself.
+	const uint8_t GetStreamByte(const PacketSizeType byteIndex) { return 0; }
+#endif
+};
+
+// One piece of a scattered packet, see SendPacket(segments, segmentCount).
+struct PacketSegment
+{
+	const uint8_t* Data;
+	PacketSizeType Size;
+};
+
+#if defined(ARDUINO_ARCH_AVR)
+// Timer vector is defined in cpp and forwards to the started writer.
+extern void (*PulseIntervalModulatorWriterInterrupt)(void);
+#endif
+
+// Only one writer can be started at a time, as it owns the timer interrupt.
+template<typename HandlerType>
+class TemplatePacketWriter
+{
+private:
+	static TemplatePacketWriter* Instance;
+
 private:
 #if defined(PIM_USE_FAST)
 	FastOut PinOut;
@@ -34,33 +77,73 @@ private:
 	const uint8_t WritePin = 0;
 #endif
 
+	// Values are fixed regardless of options, trace dumps refer to them.
 	enum WriteState
 	{
 		Done = 0,
 		WritingHeader = 1,
-		WritingDataBits = 2
+		WritingDataBits = 2,
+#if defined(PIM_EXTENDED_HEADER)
+		WritingExtendedSize = 3
+#endif
 	};
 
 	volatile WriteState State = WriteState::Done;
 
-	uint8_t* RawOutputData = nullptr;
-	volatile uint8_t PacketSize = 0;
-	volatile uint8_t RawOutputByte = 0;
+	// Packet pieces, a contiguous packet takes the first one.
+	PacketSegment Segments[Constants::MaxPacketSegments];
+	const uint8_t* SegmentCursor = nullptr;
+	PacketSizeType SegmentLeft = 0;
+	uint8_t SegmentIndex = 0;
+
+#if defined(PIM_STREAMING)
+	// Bytes come from the handler, instead of the segments.
+	bool Streaming = false;
+	uint8_t StreamByte = 0;
+#endif
+
+	volatile PacketSizeType PacketSize = 0;
+	volatile PacketSizeType RawOutputByte = 0;
 	volatile uint8_t RawOutputBit = 0;
 
-#if defined(PIM_USE_STATIC_CALLBACK)
-	void (*Callback)(void) = nullptr;
+	// Header bits, size minus MinDataBytes or the escape value, then the rate bit.
+	volatile uint8_t HeaderValue = 0;
+
+#if defined(PIM_RATE_SWITCHING)
+	volatile bool FastRate = false;
+	volatile bool FastPacket = false;
+#endif
+
+#if defined(PIM_FEC)
+	// Code word of the byte being written.
+	volatile uint16_t OutputWord = 0;
 #else
-	PacketWriterCallback* Callback = nullptr;
+	// Byte being written.
+	volatile uint8_t OutputWord = 0;
+#endif
+
+#if defined(PIM_EXTENDED_HEADER)
+	uint8_t ExtendedSize[Constants::MaxExtendedGroups];
+	uint8_t ExtendedSizeCount = 0;
+#endif
+
+#if defined(PIM_TRACE)
+	PulseTraceRing<Constants::TraceSize> TraceRing;
+#endif
+
+#if defined(PIM_TIME_SYNC)
+	uint32_t StartTimestamp = 0;
 #endif
 
 	InterruptTimerWrapper TimerWrapper;
 
-	const uint8_t MaxDataBytes = 0;
+	HandlerType Handler;
+
+	const PacketSizeType MaxDataBytes = 0;
 
 public:
-#if defined(ARDUINO_ARCH_AVR)
-	PacketWriter(const uint8_t maxDataBytes, const uint8_t writePin)
+#if defined(ARDUINO_ARCH_AVR) || defined(PIM_HOST)
+	TemplatePacketWriter(const HandlerType& handler, const PacketSizeType maxDataBytes, const uint8_t writePin)
 #if defined(PIM_USE_FAST)
 		: PinOut(writePin, false)
 #else
@@ -68,21 +151,22 @@ public:
 #endif
 		, TimerWrapper()
 #elif defined(ARDUINO_ARCH_STM32F1)
-	PacketWriter(const uint8_t maxDataBytes, const uint8_t writePin, const uint8_t timerIndex, const uint8_t timerChannel)
+	TemplatePacketWriter(const HandlerType& handler, const PacketSizeType maxDataBytes, const uint8_t writePin, const uint8_t timerIndex, const uint8_t timerChannel)
 		: WritePin(writePin)
 		, TimerWrapper(timerIndex, timerChannel)
 #endif
+		, Handler(handler)
 		, MaxDataBytes(maxDataBytes)
 	{
 	}
 
-#if defined(PIM_USE_STATIC_CALLBACK)
-	void Start(void (*callback)(void))
-#else
-	void Start(PacketWriterCallback* callback)
-#endif
+	HandlerType& GetHandler()
+	{
+		return Handler;
+	}
+
+	void Start()
 	{
-		Callback = callback;
 #if defined(PIM_USE_FAST)
 		PinOut = false;
 #else
@@ -91,17 +175,20 @@ public:
 #endif
 
 		SetupInterrupt();
-		Start();
-	}
-
-	void Start()
-	{
 		State = WriteState::Done;
 		TimerWrapper.AttachInterrupt();
 	}
 
+	// Also aborts a packet in progress, without OnPacketSent.
 	void Stop()
 	{
+#if defined(PIM_TRACE)
+		if (State != WriteState::Done)
+		{
+			TraceRing.Record(micros(), State, TraceAborted);
+			TraceRing.Freeze();
+		}
+#endif
 		State = WriteState::Done;
 		TimerWrapper.DetachInterrupt();
 	}
@@ -109,26 +196,17 @@ public:
 	void OnWriterInterrupt()
 	{
 		PulseOut();
+		Trace(TracePulse);
 		switch (State)
 		{
 		case WriteState::Done:
 			// Last pulse is out.
-#if defined(PIM_SAFETY_CHECKS)
-			if (Callback != nullptr)
-#endif
-			{
-#if defined(PIM_USE_STATIC_CALLBACK)
-				Callback();
-#else
-				Callback->OnPacketSent();
-#endif
-			}
+			Handler.OnPacketSent();
 			TimerWrapper.DetachInterrupt();
 			break;
 		case WriteState::WritingHeader:
 			// Sending header with packet size MSB first.
-			// Remove MinDataBytes, according to specification.
-			if ((PacketSize - Constants::MinDataBytes) & (1 << (Constants::HeaderBits - 1 - RawOutputBit)))
+			if (HeaderValue & (1 << (Constants::HeaderFieldBits - 1 - RawOutputBit)))
 			{
 				TimerWrapper.InterruptAfterOne();
 			}
@@ -138,16 +216,75 @@ public:
 			}
 			RawOutputBit++;
 
-			if (RawOutputBit > (Constants::HeaderBits - 1))
+			if (RawOutputBit > (Constants::HeaderFieldBits - 1))
 			{
 				// Header almost done, start pushing on the next interrupt.
+#if defined(PIM_EXTENDED_HEADER)
+				State = (ExtendedSizeCount > 0) ? WriteState::WritingExtendedSize : WriteState::WritingDataBits;
+#else
 				State = WriteState::WritingDataBits;
+#endif
 				RawOutputBit = 0;
 			}
 			break;
+#if defined(PIM_EXTENDED_HEADER)
+		case WriteState::WritingExtendedSize:
+			// Sending size groups MSB first, RawOutputByte indexes the group.
+			if ((ExtendedSize[RawOutputByte] >> (7 - RawOutputBit)) & 0x01)
+			{
+				TimerWrapper.InterruptAfterOne();
+			}
+			else
+			{
+				TimerWrapper.InterruptAfterZero();
+			}
+			RawOutputBit++;
+
+			if (RawOutputBit > 7)
+			{
+				RawOutputByte++;
+				RawOutputBit = 0;
+
+				if (RawOutputByte >= ExtendedSizeCount)
+				{
+					RawOutputByte = 0;
+					State = WriteState::WritingDataBits;
+				}
+			}
+			break;
+#endif
 		case WriteState::WritingDataBits:
+			if (RawOutputBit == 0)
+			{
+				if (!Handler.CanWriteByte(RawOutputByte))
+				{
+					// Data source fell behind.
+					Stop();
+					break;
+				}
+#if defined(PIM_FEC)
+				OutputWord = HammingCode::Encode(LoadNextByte());
+#else
+				OutputWord = LoadNextByte();
+#endif
+			}
+
 			// Sending data with MSB first.
-			if ((RawOutputData[RawOutputByte] >> (7 - RawOutputBit)) & 0x01)
+#if defined(PIM_RATE_SWITCHING)
+			if (FastPacket)
+			{
+				if (GetDataBit())
+				{
+					TimerWrapper.InterruptAfterFastOne();
+				}
+				else
+				{
+					TimerWrapper.InterruptAfterFastZero();
+				}
+			}
+			else
+#endif
+			if (GetDataBit())
 			{
 				TimerWrapper.InterruptAfterOne();
 			}
@@ -155,9 +292,20 @@ public:
 			{
 				TimerWrapper.InterruptAfterZero();
 			}
+
+#if defined(PIM_STREAMING)
+			if (Streaming
+				&& RawOutputBit == 0
+				&& RawOutputByte < (PacketSize - 1))
+			{
+				// Ask for the next byte only now, the compare is already set from the counter
+				// and the producer has a whole byte of time.
+				StreamByte = Handler.GetStreamByte(RawOutputByte + 1);
+			}
+#endif
 			RawOutputBit++;
 
-			if (RawOutputBit > 7)
+			if (RawOutputBit > (Constants::DataWordBits - 1))
 			{
 				// One full byte written.
 				RawOutputByte++;
@@ -175,11 +323,107 @@ public:
 		}
 	}
 
+#if defined(PIM_RATE_SWITCHING)
+	// Payload rate for the next packets, the receivers must support the fast profile.
+	void SetFastRate(const bool fastRate)
+	{
+		FastRate = fastRate;
+	}
+
+	const bool IsFastRate()
+	{
+		return FastRate;
+	}
+#endif
+
+#if defined(PIM_TRACE)
+	// Stops recording, the ring keeps the last pulses. Also done on abort.
+	void FreezeTrace()
+	{
+		TraceRing.Freeze();
+	}
+
+	void ResumeTrace()
+	{
+		TraceRing.Resume();
+	}
+
+	// Freeze before reading.
+	const PulseTraceRing<Constants::TraceSize>& GetTrace()
+	{
+		return TraceRing;
+	}
+#endif
+
+#if defined(PIM_TIME_SYNC)
+	// Start pulse of the last packet sent.
+	const uint32_t GetStartTimestamp() const
+	{
+		return StartTimestamp;
+	}
+#endif
+
+#if defined(PIM_HOST)
+	// Host tools drive the mock timer directly.
+	InterruptTimerWrapper& GetTimerWrapper()
+	{
+		return TimerWrapper;
+	}
+#endif
+
 private:
-	// Defined in cpp.
-	void SetupInterrupt();
+	static void OnTimerInterrupt()
+	{
+		Instance->OnWriterInterrupt();
+	}
+
+	void SetupInterrupt()
+	{
+		Instance = this;
+#if defined(ARDUINO_ARCH_AVR)
+		PulseIntervalModulatorWriterInterrupt = OnTimerInterrupt;
+#else
+		TimerWrapper.ConfigureTimer(OnTimerInterrupt);
+#endif
+	}
 
 private:
+	// Current data bit, of the byte or of its code word.
+	const bool GetDataBit()
+	{
+		return (OutputWord >> (Constants::DataWordBits - 1 - RawOutputBit)) & 0x01;
+	}
+
+	// Walks the segments, skipping empty ones.
+	// Never runs past the last one, as PacketSize is their total.
+	const uint8_t LoadNextByte()
+	{
+#if defined(PIM_STREAMING)
+		if (Streaming)
+		{
+			// Asked for during the previous byte.
+			return StreamByte;
+		}
+#endif
+		while (SegmentLeft == 0)
+		{
+			SegmentIndex++;
+			SegmentCursor = Segments[SegmentIndex].Data;
+			SegmentLeft = Segments[SegmentIndex].Size;
+		}
+		SegmentLeft--;
+
+		return *SegmentCursor++;
+	}
+
+	// Compiles away without PIM_TRACE.
+	void Trace(const PulseTraceVerdict verdict)
+	{
+#if defined(PIM_TRACE)
+		TraceRing.Record(micros(), State, verdict);
+#endif
+	}
+
 	void PulseOut()
 	{
 #if defined(PIM_USE_FAST)
@@ -193,7 +437,7 @@ private:
 
 public:
 	// packetData must not be a valid array.
-	void SendPacket(uint8_t* packetData, const uint8_t packetSize)
+	void SendPacket(uint8_t* packetData, const PacketSizeType packetSize)
 	{
 #if defined(PIM_SAFETY_CHECKS)
 		if (packetData == nullptr || packetSize > MaxDataBytes || packetSize < Constants::MinDataBytes)
@@ -201,17 +445,176 @@ public:
 			return;
 		}
 #endif 
-		RawOutputData = packetData;
+		Segments[0].Data = packetData;
+		Segments[0].Size = packetSize;
+#if defined(PIM_STREAMING)
+		Streaming = false;
+#endif
+
+		StartPacket(packetSize);
+	}
+
+	// Sends the segments back to back as one packet, such as a header and a payload, without copying.
+	// The segment list is copied, up to PIM_MAX_PACKET_SEGMENTS, the data is read while sending.
+	void SendPacket(const PacketSegment* segments, const uint8_t segmentCount)
+	{
+#if defined(PIM_SAFETY_CHECKS)
+		if (segments == nullptr || segmentCount == 0 || segmentCount > Constants::MaxPacketSegments)
+		{
+			return;
+		}
+#endif
+		uint32_t packetSize = 0;
+		for (uint8_t i = 0; i < segmentCount; i++)
+		{
+#if defined(PIM_SAFETY_CHECKS)
+			if (segments[i].Data == nullptr && segments[i].Size > 0)
+			{
+				return;
+			}
+#endif
+			Segments[i] = segments[i];
+			packetSize += segments[i].Size;
+		}
+
+#if defined(PIM_SAFETY_CHECKS)
+		if (packetSize > MaxDataBytes || packetSize < Constants::MinDataBytes)
+		{
+			return;
+		}
+#endif
+#if defined(PIM_STREAMING)
+		Streaming = false;
+#endif
+		StartPacket(packetSize);
+	}
+
+#if defined(PIM_STREAMING)
+	// Sends packetSize bytes asked one by one from the handler's GetStreamByte(), no buffer needed.
+	void SendStream(const PacketSizeType packetSize)
+	{
+#if defined(PIM_SAFETY_CHECKS)
+		if (packetSize > MaxDataBytes || packetSize < Constants::MinDataBytes)
+		{
+			return;
+		}
+#endif
+		Streaming = true;
+		StreamByte = Handler.GetStreamByte(0);
+
+		StartPacket(packetSize);
+	}
+#endif
 
+private:
+	void StartPacket(const PacketSizeType packetSize)
+	{
 		PacketSize = packetSize;
 
+		SegmentIndex = 0;
+		SegmentCursor = Segments[0].Data;
+		SegmentLeft = Segments[0].Size;
+
 		RawOutputByte = 0;
 		RawOutputBit = 0;
 
+#if defined(PIM_EXTENDED_HEADER)
+		ExtendedSizeCount = 0;
+		if (packetSize >= Constants::ExtendedBaseBytes)
+		{
+			HeaderValue = Constants::HeaderEscape;
+
+			// Split into 7 bit groups, MSB first.
+			PacketSizeType extendedSize = packetSize - Constants::ExtendedBaseBytes;
+			uint8_t groups = 1;
+			while ((extendedSize >> (Constants::ExtendedGroupBits * groups)) > 0)
+			{
+				groups++;
+			}
+
+			for (uint8_t i = 0; i < groups; i++)
+			{
+				ExtendedSize[groups - 1 - i] = (extendedSize & 0x7F) | ((i > 0) ? 0x80 : 0);
+				extendedSize >>= Constants::ExtendedGroupBits;
+			}
+			ExtendedSizeCount = groups;
+		}
+		else
+#endif
+		{
+			// Remove MinDataBytes, according to specification.
+			HeaderValue = packetSize - Constants::MinDataBytes;
+		}
+
+#if defined(PIM_RATE_SWITCHING)
+		// Rate is latched for the whole packet.
+		FastPacket = FastRate;
+		HeaderValue = (HeaderValue << Constants::RateBits) | FastPacket;
+#endif
+
 		// PreAmble and Packet start sequence.
 		State = WriteState::WritingHeader;
+#if defined(PIM_TIME_SYNC)
+		StartTimestamp = micros();
+#endif
 		PulseOut();
+		Trace(TraceStart);
 		TimerWrapper.InterruptAfterPreamble();
 	}
 };
+
+template<typename HandlerType>
+TemplatePacketWriter<HandlerType>* TemplatePacketWriter<HandlerType>::Instance = nullptr;
+
+// Forwards to the callback set on Start.
+class CallbackWriterHandler : public PacketWriterHandler
+{
+public:
+#if defined(PIM_USE_STATIC_CALLBACK)
+	void (*Callback)(void) = nullptr;
+#else
+	PacketWriterCallback* Callback = nullptr;
+#endif
+
+public:
+	void OnPacketSent()
+	{
+#if defined(PIM_SAFETY_CHECKS)
+		if (Callback != nullptr)
+#endif
+		{
+#if defined(PIM_USE_STATIC_CALLBACK)
+			Callback();
+#else
+			Callback->OnPacketSent();
+#endif
+		}
+	}
+};
+
+class PacketWriter : public TemplatePacketWriter<CallbackWriterHandler>
+{
+public:
+#if defined(ARDUINO_ARCH_AVR) || defined(PIM_HOST)
+	PacketWriter(const PacketSizeType maxDataBytes, const uint8_t writePin)
+		: TemplatePacketWriter<CallbackWriterHandler>(CallbackWriterHandler(), maxDataBytes, writePin)
+#elif defined(ARDUINO_ARCH_STM32F1)
+	PacketWriter(const PacketSizeType maxDataBytes, const uint8_t writePin, const uint8_t timerIndex, const uint8_t timerChannel)
+		: TemplatePacketWriter<CallbackWriterHandler>(CallbackWriterHandler(), maxDataBytes, writePin, timerIndex, timerChannel)
+#endif
+	{
+	}
+
+	using TemplatePacketWriter<CallbackWriterHandler>::Start;
+
+#if defined(PIM_USE_STATIC_CALLBACK)
+	void Start(void (*callback)(void))
+#else
+	void Start(PacketWriterCallback* callback)
+#endif
+	{
+		GetHandler().Callback = callback;
+		Start();
+	}
+};
 #endif
\ No newline at end of file
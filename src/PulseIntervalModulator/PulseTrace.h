@@ -0,0 +1,132 @@
+// PulseTrace.h
+// Fixed size ring of pulse events, for post-mortem timing analysis with PIM_TRACE.
+// Each entry holds the pulse timestamp, the reader or writer state that handled it and a verdict.
+// Recording stops once frozen, so the ring keeps the events that led up to it.
+// Dump() prints one entry per line, extras/TraceToVcd converts dumps to VCD.
+
+#ifndef _PIM_PULSE_TRACE_h
+#define _PIM_PULSE_TRACE_h
+
+#include <stdint.h>
+
+enum PulseTraceVerdict : uint8_t
+{
+	// Reader.
+	TraceStart = 0, // Start pulse, or restart after a reject.
+	TracePreamble = 1,
+	TracePreambleReject = 2,
+	TraceZero = 3,
+	TraceOne = 4,
+	TraceHeaderReject = 5,
+	TraceSizeReject = 6,
+	TraceDataReject = 7,
+	TraceGlitch = 8,
+	TraceErasure = 9,
+	TraceReceived = 10,
+	TraceFiltered = 11,
+	TraceSkipped = 12,
+	TraceTimeout = 13,
+	TraceEcho = 14, // Own pulse read back while sending.
+	TraceCollision = 15,
+
+	// Writer.
+	TracePulse = 16,
+	TraceAborted = 17,
+
+	// Reader, with PIM_RESYNC.
+	TraceResync = 18 // Preamble from an earlier start pulse, after a reject.
+};
+
+struct PulseTraceEntry
+{
+	uint32_t Timestamp;
+	uint8_t State;
+	uint8_t Verdict;
+};
+
+template<const uint8_t TraceSize>
+class PulseTraceRing
+{
+private:
+	static_assert(TraceSize > 0 && TraceSize <= 128 && ((TraceSize & (TraceSize - 1)) == 0),
+		"TraceSize must be a power of 2, up to 128.");
+
+	static const uint8_t IndexMask = TraceSize - 1;
+
+	PulseTraceEntry Entries[TraceSize];
+
+	// Next entry to write, the oldest once the ring is full.
+	volatile uint8_t Head = 0;
+	volatile uint8_t Count = 0;
+	volatile bool Frozen = false;
+
+public:
+	// Called during interrupts.
+	void Record(const uint32_t timestamp, const uint8_t state, const uint8_t verdict)
+	{
+		if (!Frozen)
+		{
+			PulseTraceEntry& entry = Entries[Head];
+			entry.Timestamp = timestamp;
+			entry.State = state;
+			entry.Verdict = verdict;
+			Head = (Head + 1) & IndexMask;
+			if (Count < TraceSize)
+			{
+				Count = Count + 1;
+			}
+		}
+	}
+
+	void Freeze()
+	{
+		Frozen = true;
+	}
+
+	// Clears the ring and starts recording again.
+	void Resume()
+	{
+		Head = 0;
+		Count = 0;
+		Frozen = false;
+	}
+
+	const bool IsFrozen() const
+	{
+		return Frozen;
+	}
+
+	const uint8_t GetCount() const
+	{
+		return Count;
+	}
+
+	// Oldest first, stable only while frozen.
+	const PulseTraceEntry& Get(const uint8_t index) const
+	{
+		if (Count < TraceSize)
+		{
+			return Entries[index];
+		}
+
+		return Entries[(Head + index) & IndexMask];
+	}
+
+	// Prints "source,timestamp,state,verdict" lines, oldest first.
+	template<typename StreamType>
+	void Dump(StreamType& stream, const char source) const
+	{
+		for (uint8_t i = 0; i < GetCount(); i++)
+		{
+			const PulseTraceEntry& entry = Get(i);
+			stream.print(source);
+			stream.print(',');
+			stream.print(entry.Timestamp);
+			stream.print(',');
+			stream.print(entry.State);
+			stream.print(',');
+			stream.println(entry.Verdict);
+		}
+	}
+};
+#endif
\ No newline at end of file
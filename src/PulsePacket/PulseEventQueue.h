@@ -0,0 +1,113 @@
+// PulseEventQueue.h
+// Single producer, single consumer event ring.
+// Interrupts push events, the task drains them.
+// Lock-free: only the producer writes Head, only the consumer writes Tail.
+
+#ifndef _PULSE_EVENT_QUEUE_h
+#define _PULSE_EVENT_QUEUE_h
+
+#include <stdint.h>
+#include <PulseIntervalModulator/Constants.h>
+
+template<const uint8_t QueueSize>
+class PulseEventQueue
+{
+public:
+	enum EventType : uint8_t
+	{
+		PacketLost,
+		PacketReceived,
+		PacketSent,
+#if defined(PIM_CSMA)
+		PacketCollision
+#endif
+	};
+
+	struct EventStruct
+	{
+		uint32_t Timestamp;
+		PacketSizeType Size;
+		EventType Type;
+	};
+
+private:
+	static_assert(QueueSize > 0 && QueueSize <= 128 && ((QueueSize & (QueueSize - 1)) == 0),
+		"QueueSize must be a power of 2, up to 128.");
+
+	static const uint8_t IndexMask = QueueSize - 1;
+
+	EventStruct Events[QueueSize];
+
+	// Free running indexes, roll-over is implicit.
+	volatile uint8_t Head = 0;
+	volatile uint8_t Tail = 0;
+
+	volatile uint8_t DroppedCount = 0;
+
+public:
+	PulseEventQueue()
+	{
+	}
+
+	// Producer side, called during interrupts.
+	// Returns false if the queue is full and the event was dropped.
+	const bool Push(const EventType type, const uint32_t timestamp, const PacketSizeType size)
+	{
+		const uint8_t head = Head;
+
+		if ((uint8_t)(head - Tail) >= QueueSize)
+		{
+			DroppedCount++;
+			return false;
+		}
+
+		EventStruct& event = Events[head & IndexMask];
+		event.Timestamp = timestamp;
+		event.Size = size;
+		event.Type = type;
+
+		// Publish only after the event is written.
+		MemoryBarrier();
+		Head = head + 1;
+
+		return true;
+	}
+
+	// Consumer side, called from the task.
+	const bool Pop(EventStruct& event)
+	{
+		const uint8_t tail = Tail;
+
+		if (tail == Head)
+		{
+			return false;
+		}
+
+		MemoryBarrier();
+		event = Events[tail & IndexMask];
+
+		// Release the slot only after the event is read.
+		MemoryBarrier();
+		Tail = tail + 1;
+
+		return true;
+	}
+
+	const bool IsEmpty()
+	{
+		return Tail == Head;
+	}
+
+	const uint8_t GetDroppedCount()
+	{
+		return DroppedCount;
+	}
+
+private:
+	// Single core, stop the compiler from reordering around the index updates.
+	static inline void MemoryBarrier()
+	{
+		__asm__ __volatile__("" ::: "memory");
+	}
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,440 @@
+// PulseLzss.h
+// LZSS payload compression, for bulk text and tables.
+// The encoder produces one byte at a time and the decoder takes one byte at a time,
+// so both fit the PIM_STREAMING handler calls, GetStreamByte() and OnStreamByte().
+//
+// Each packet starts with its source offset, 16 bits, then the bit stream, MSB first.
+// Each token is a flag bit, then either a literal byte (0)
+// or a match (1) of OffsetBits distance - 1 and LengthBits length - MinMatch.
+// The last byte is padded with zero bits, shorter than a literal.
+//
+// A transfer is split into packets, matches can reach back into the previous packets,
+// so packets must be decoded in order. The decoder refuses a packet whose offset isn't its decoded size,
+// such as a repeat or the one after a lost packet, instead of decoding it against the wrong history.
+// Only the receiver knows a packet is missing: recovering needs a way back to the sender,
+// such as an acknowledge with the decoder's GetSize(). Without it, the transfer stops short.
+// The encoder reads the source in place and keeps a single entry hash table.
+// Each GetByte() encodes at most one token, as tokens are 9 bits or more: one hash, one table lookup
+// and a match compare of up to MaxMatch bytes. Counted from the instruction sequence, that's about
+// 250 AVR cycles plus 11 per MaxMatch byte, 450 for the default format or 28 us at 16 MHz,
+// inside a zero interval as the writer asks for the next byte right after setting the compare.
+// The decoder writes to the destination in place, matches are copied from what it already holds.
+//
+// Sending:
+//	Encoder.Start(source, sourceSize);
+//	while (!Encoder.IsDone())
+//		Writer.SendStream(Encoder.NextPacket(maxPacketSize)); // GetStreamByte() returns Encoder.GetByte().
+//		If the acknowledged size doesn't cover the packet, Encoder.RepeatPacket() and send again.
+// Receiving:
+//	Decoder.Start(destination, capacity);
+//	OnStreamByte() calls Decoder.Push(value), the packet is committed with Decoder.CommitPacket() on OnPacketReceived(),
+//	false if corrupt or out of order, or dropped with Decoder.DropPacket() on OnPacketLost().
+//	Acknowledge with Decoder.GetSize().
+
+#ifndef _PULSE_LZSS_h
+#define _PULSE_LZSS_h
+
+#include <stdint.h>
+#include <PulseIntervalModulator/Constants.h>
+
+template<const uint8_t OffsetBits = 8, const uint8_t LengthBits = 4>
+class PulseLzssFormat
+{
+public:
+	static_assert(OffsetBits >= 4 && OffsetBits <= 12, "OffsetBits must be 4 to 12.");
+	static_assert(LengthBits >= 2 && LengthBits <= 6, "LengthBits must be 2 to 6.");
+
+	static const uint8_t MinMatch = 3;
+	static const uint8_t MaxMatch = MinMatch + (1 << LengthBits) - 1;
+	static const uint16_t WindowSize = 1 << OffsetBits;
+
+	static const uint8_t HeaderSize = 2;
+	static const uint8_t LiteralBits = 1 + 8;
+	static const uint8_t MatchBits = 1 + OffsetBits + LengthBits;
+};
+
+template<const uint8_t OffsetBits = 8, const uint8_t LengthBits = 4, const uint8_t HashBits = 6>
+class PulseLzssEncoder
+{
+private:
+	typedef PulseLzssFormat<OffsetBits, LengthBits> Format;
+
+	static_assert(HashBits >= 4 && HashBits <= 10, "HashBits must be 4 to 10.");
+
+	static const uint16_t HashSize = 1 << HashBits;
+
+	// Last position + 1 of each 3 byte hash, 0 for none.
+	uint16_t Table[HashSize];
+
+	const uint8_t* Source = nullptr;
+	uint16_t SourceSize = 0;
+
+	// Current packet's source range.
+	uint16_t PacketStart = 0;
+	uint16_t PacketEnd = 0;
+
+	// Tokens don't read past this.
+	uint16_t Limit = 0;
+	uint16_t Position = 0;
+
+	uint32_t BitBuffer = 0;
+	uint8_t BitCount = 0;
+
+	// Header bytes left to send, the packet's source offset.
+	uint8_t HeaderPending = 0;
+
+public:
+	// Whole transfer, read in place until done.
+	void Start(const uint8_t* source, const uint16_t sourceSize)
+	{
+		Source = source;
+		SourceSize = sourceSize;
+		PacketStart = 0;
+		PacketEnd = 0;
+		HeaderPending = 0;
+	}
+
+	const bool IsDone() const
+	{
+		return PacketEnd >= SourceSize;
+	}
+
+	// Size pre-pass, main loop only. Takes as much of the source as fits in maxPacketSize compressed bytes,
+	// at least 4, then rewinds for GetByte(). Returns the packet size, with the header.
+	const PacketSizeType NextPacket(const PacketSizeType maxPacketSize)
+	{
+		PacketStart = PacketEnd;
+		Limit = SourceSize;
+		Rewind();
+
+		const uint32_t maxBits = (uint32_t)(maxPacketSize - Format::HeaderSize) * 8;
+		uint32_t bits = 0;
+		while (Position < Limit)
+		{
+			const uint16_t tokenStart = Position;
+			const uint8_t tokenBits = EncodeToken();
+			if (bits + tokenBits > maxBits)
+			{
+				Position = tokenStart;
+				break;
+			}
+			bits += tokenBits;
+			BitCount = 0;
+		}
+
+		// The same packet end gives the same tokens again.
+		PacketEnd = Position;
+		Limit = PacketEnd;
+		Rewind();
+		HeaderPending = Format::HeaderSize;
+
+		return Format::HeaderSize + (bits + 7) / 8;
+	}
+
+	// Sends the last packet again, after NextPacket().
+	void RepeatPacket()
+	{
+		PacketEnd = PacketStart;
+	}
+
+	// Source offset of the current packet.
+	const uint16_t GetSourceOffset() const
+	{
+		return PacketStart;
+	}
+
+	// Source bytes in the current packet.
+	const uint16_t GetSourceUsed() const
+	{
+		return PacketEnd - PacketStart;
+	}
+
+	// Next compressed byte, bounded to one token for the writer's interrupt.
+	const uint8_t GetByte()
+	{
+		if (HeaderPending > 0)
+		{
+			HeaderPending--;
+
+			return (uint8_t)(PacketStart >> (HeaderPending * 8));
+		}
+
+		while (BitCount < 8
+			&& Position < Limit)
+		{
+			EncodeToken();
+		}
+
+		if (BitCount < 8)
+		{
+			// Last byte, pad with zeros.
+			BitBuffer <<= (8 - BitCount);
+			BitCount = 8;
+		}
+
+		BitCount -= 8;
+
+		return (uint8_t)(BitBuffer >> BitCount);
+	}
+
+private:
+	// Back to the packet start, with the table rebuilt from the window before it.
+	void Rewind()
+	{
+		for (uint16_t i = 0; i < HashSize; i++)
+		{
+			Table[i] = 0;
+		}
+
+		const uint16_t windowStart = (PacketStart > Format::WindowSize) ? PacketStart - Format::WindowSize : 0;
+		for (uint16_t i = windowStart; i < PacketStart; i++)
+		{
+			Insert(i);
+		}
+
+		Position = PacketStart;
+		BitBuffer = 0;
+		BitCount = 0;
+	}
+
+	static const uint16_t Hash(const uint8_t* data)
+	{
+		const uint16_t value = ((uint16_t)data[0] << 8) ^ ((uint16_t)data[1] << 4) ^ data[2];
+
+		return (uint16_t)(value * 40503U) >> (16 - HashBits);
+	}
+
+	void Insert(const uint16_t position)
+	{
+		if (position + Format::MinMatch <= Limit)
+		{
+			Table[Hash(&Source[position])] = position + 1;
+		}
+	}
+
+	// Appends one token to BitBuffer, returns its size in bits.
+	const uint8_t EncodeToken()
+	{
+		const uint16_t remaining = Limit - Position;
+		uint16_t distance = 0;
+		uint8_t length = 0;
+
+		if (remaining >= Format::MinMatch)
+		{
+			const uint16_t hash = Hash(&Source[Position]);
+			const uint16_t candidate = Table[hash];
+			Table[hash] = Position + 1;
+
+			if (candidate != 0)
+			{
+				distance = Position - (candidate - 1);
+				if (distance <= Format::WindowSize)
+				{
+					const uint8_t maxLength = (remaining < Format::MaxMatch) ? remaining : Format::MaxMatch;
+					const uint8_t* match = &Source[candidate - 1];
+					const uint8_t* current = &Source[Position];
+					while (length < maxLength
+						&& match[length] == current[length])
+					{
+						length++;
+					}
+				}
+			}
+		}
+
+		if (length >= Format::MinMatch)
+		{
+			PushBits((1UL << (OffsetBits + LengthBits))
+				| ((uint32_t)(distance - 1) << LengthBits)
+				| (length - Format::MinMatch), Format::MatchBits);
+
+			// Positions inside the match aren't inserted, it would bound GetByte() by MaxMatch hashes
+			// and with a single entry table they mostly evict better candidates.
+			Position += length;
+
+			return Format::MatchBits;
+		}
+		else
+		{
+			PushBits(Source[Position], Format::LiteralBits);
+			Position++;
+
+			return Format::LiteralBits;
+		}
+	}
+
+	void PushBits(const uint32_t value, const uint8_t bits)
+	{
+		BitBuffer = (BitBuffer << bits) | value;
+		BitCount += bits;
+	}
+};
+
+template<const uint8_t OffsetBits = 8, const uint8_t LengthBits = 4>
+class PulseLzssDecoder
+{
+private:
+	typedef PulseLzssFormat<OffsetBits, LengthBits> Format;
+
+	uint8_t* Destination = nullptr;
+	uint16_t Capacity = 0;
+	uint16_t Size = 0;
+
+	// Size when the current packet started.
+	uint16_t PacketStart = 0;
+
+	uint32_t BitBuffer = 0;
+	uint8_t BitCount = 0;
+
+	// Current packet's source offset, checked against PacketStart once its header is in.
+	uint16_t PacketOffset = 0;
+	uint8_t HeaderCount = 0;
+	bool OutOfOrder = false;
+
+	bool Corrupt = false;
+
+public:
+	// Whole transfer, written in place.
+	void Start(uint8_t* destination, const uint16_t capacity)
+	{
+		Destination = destination;
+		Capacity = capacity;
+		Size = 0;
+		PacketStart = 0;
+		BitBuffer = 0;
+		BitCount = 0;
+		HeaderCount = 0;
+		OutOfOrder = false;
+		Corrupt = false;
+	}
+
+	// Drops what was decoded of a lost packet, ready for it to be sent again.
+	void DropPacket()
+	{
+		Size = PacketStart;
+		BitBuffer = 0;
+		BitCount = 0;
+		HeaderCount = 0;
+		OutOfOrder = false;
+		Corrupt = false;
+	}
+
+	// Keeps the packet, call once it's received. Drops the padding bits.
+	// Returns false and drops it instead if it was corrupt or out of order, a repeat or after a lost packet.
+	const bool CommitPacket()
+	{
+		if (Corrupt || OutOfOrder || HeaderCount < Format::HeaderSize)
+		{
+			DropPacket();
+
+			return false;
+		}
+
+		PacketStart = Size;
+		BitBuffer = 0;
+		BitCount = 0;
+		HeaderCount = 0;
+
+		return true;
+	}
+
+	// Decodes the tokens completed by this byte, cheap enough for the reader's interrupt.
+	// Returns false once the stream is corrupt, such as a match before the start or past the capacity,
+	// or for a packet out of order, which is ignored.
+	const bool Push(const uint8_t value)
+	{
+		if (Corrupt)
+		{
+			return false;
+		}
+
+		if (HeaderCount < Format::HeaderSize)
+		{
+			PacketOffset = (PacketOffset << 8) | value;
+			HeaderCount++;
+			OutOfOrder = HeaderCount == Format::HeaderSize && PacketOffset != PacketStart;
+
+			return !OutOfOrder;
+		}
+
+		if (OutOfOrder)
+		{
+			return false;
+		}
+
+		BitBuffer = (BitBuffer << 8) | value;
+		BitCount += 8;
+
+		// Padding is zeros, never a whole token.
+		while (BitCount > 0)
+		{
+			if (((BitBuffer >> (BitCount - 1)) & 0x01) == 0)
+			{
+				if (BitCount < Format::LiteralBits)
+				{
+					break;
+				}
+
+				BitCount -= Format::LiteralBits;
+				if (!Write((uint8_t)(BitBuffer >> BitCount)))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				if (BitCount < Format::MatchBits)
+				{
+					break;
+				}
+
+				BitCount -= Format::MatchBits;
+				const uint32_t token = BitBuffer >> BitCount;
+				const uint16_t distance = ((token >> LengthBits) & (Format::WindowSize - 1)) + 1;
+				const uint8_t length = (token & ((1 << LengthBits) - 1)) + Format::MinMatch;
+
+				if (distance > Size)
+				{
+					Corrupt = true;
+					return false;
+				}
+
+				for (uint8_t i = 0; i < length; i++)
+				{
+					if (!Write(Destination[Size - distance]))
+					{
+						return false;
+					}
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// Decoded bytes so far, of all packets. The next packet's expected offset once committed.
+	const uint16_t GetSize() const
+	{
+		return Size;
+	}
+
+	const bool IsCorrupt() const
+	{
+		return Corrupt;
+	}
+
+private:
+	const bool Write(const uint8_t value)
+	{
+		if (Size >= Capacity)
+		{
+			Corrupt = true;
+			return false;
+		}
+
+		Destination[Size++] = value;
+
+		return true;
+	}
+};
+#endif
\ No newline at end of file
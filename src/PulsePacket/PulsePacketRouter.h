@@ -0,0 +1,97 @@
+// PulsePacketRouter.h
+// Dispatches received packets to a handler per message type, without a switch.
+// The type byte at TypeOffset indexes the route table directly.
+// Each route can check the payload size, the bytes after the type byte.
+// Handlers get a pointer into the received packet, nothing is copied.
+//
+// The route table is built at compile time and kept in flash on AVR:
+//	constexpr PulsePacketRouter<MyDriver>::Route Routes[] PROGMEM = {
+//		{ MyDriver::OnPing, 0 },
+//		{ MyDriver::OnSample, 4 },
+//		{ MyDriver::OnText, PulsePacketRouter<MyDriver>::AnyPayloadSize }
+//	};
+// Types without a handler get a nullptr entry.
+
+#ifndef _PULSE_PACKET_ROUTER_h
+#define _PULSE_PACKET_ROUTER_h
+
+#include <PulseIntervalModulator/Constants.h>
+#include <Arduino.h>
+
+template<typename ContextType, const uint8_t TypeOffset = 0>
+class PulsePacketRouter
+{
+public:
+	typedef void (*HandlerType)(ContextType& context, const uint32_t startTimestamp, const uint8_t* payload, const PacketSizeType payloadSize);
+
+	struct Route
+	{
+		HandlerType Handler;
+		PacketSizeType PayloadSize;
+	};
+
+	// Route accepts any payload size.
+	static const PacketSizeType AnyPayloadSize = (PacketSizeType)~0;
+
+private:
+	const Route* Routes;
+	// Highest type in the table.
+	const uint8_t LastType;
+
+	uint16_t UnroutedCount = 0;
+	uint16_t RejectedCount = 0;
+
+public:
+	template<const uint16_t routeCount>
+	PulsePacketRouter(const Route(&routes)[routeCount])
+		: Routes(routes)
+		, LastType(routeCount - 1)
+	{
+		static_assert(routeCount > 0 && routeCount <= 256, "Route table must have 1 to 256 entries.");
+	}
+
+	// Returns true if the packet was handled.
+	const bool Dispatch(ContextType& context, const uint32_t startTimestamp, const uint8_t* packet, const PacketSizeType packetSize)
+	{
+		if (packetSize <= TypeOffset
+			|| packet[TypeOffset] > LastType)
+		{
+			UnroutedCount++;
+			return false;
+		}
+
+		Route route;
+		memcpy_P(&route, &Routes[packet[TypeOffset]], sizeof(Route));
+
+		if (route.Handler == nullptr)
+		{
+			UnroutedCount++;
+			return false;
+		}
+
+		const PacketSizeType payloadSize = packetSize - TypeOffset - 1;
+		if (route.PayloadSize != AnyPayloadSize
+			&& route.PayloadSize != payloadSize)
+		{
+			RejectedCount++;
+			return false;
+		}
+
+		route.Handler(context, startTimestamp, &packet[TypeOffset + 1], payloadSize);
+
+		return true;
+	}
+
+	// Packets too short for a type byte, or with a type without a handler.
+	const uint16_t GetUnroutedCount()
+	{
+		return UnroutedCount;
+	}
+
+	// Packets whose payload size didn't match the route.
+	const uint16_t GetRejectedCount()
+	{
+		return RejectedCount;
+	}
+};
+#endif
\ No newline at end of file
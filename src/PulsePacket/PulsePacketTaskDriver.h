@@ -11,41 +11,147 @@
 #define _EXAMPLEDRIVERCLASS_h
 
 #include <PulseIntervalModulator.h>
+#include "PulseEventQueue.h"
+#include "PulseLzss.h"
+#include "PulsePacketRouter.h"
+#include "PulseSendQueue.h"
+#include "PulseTimeSync.h"
 
 #define _TASK_OO_CALLBACKS
 #include <TaskSchedulerDeclarations.h>
 
+#if defined(PIM_SEND_SCHEDULER)
+struct PulseSendClassStats
+{
+	uint32_t Sent = 0;
+	uint32_t Expired = 0; // Dropped unsent, past their deadline.
+	uint32_t TotalLatency = 0; // Queued to start pulse, divide by Sent for the average.
+	uint32_t MaxLatency = 0;
+};
+#endif
+
+#if defined(PIM_SEND_QUEUE)
+struct PulseSendStats
+{
+	uint32_t Sent = 0; // Queued packets fully sent.
+	uint32_t SentBytes = 0;
+#if defined(PIM_CSMA)
+	uint32_t Deferrals = 0; // Line busy at the end of a backoff.
+	uint32_t Collisions = 0; // Packets aborted on a foreign pulse.
+	uint32_t Dropped = 0; // Packets given up after MaxSendAttempts collisions.
+#endif
+#if defined(PIM_SEND_SCHEDULER)
+	PulseSendClassStats Classes[Constants::SendPriorityClasses];
+#endif
+};
+#endif
 
-template<const uint8_t MaxPacketSize>
-class PulsePacketTaskDriver : protected Task, virtual public PacketReaderCallback, virtual public PacketWriterCallback
+template<const PacketSizeType MaxPacketSize, const uint8_t EventQueueSize = 8>
+class PulsePacketTaskDriver : protected Task
 {
 private:
-	struct InterruptFlagsType
+	typedef PulseEventQueue<EventQueueSize> EventQueueType;
+
+	// Handlers resolved at compile time, independent of PIM_USE_STATIC_CALLBACK.
+	class ReaderHandler : public PacketReaderHandler
 	{
-		volatile bool PacketLost = false;
-		volatile bool PacketReceived = false;
-		volatile bool PacketSent = false;
+	private:
+		PulsePacketTaskDriver* Driver;
+
+	public:
+		ReaderHandler(PulsePacketTaskDriver* driver) : Driver(driver) {}
+
+		void OnPacketReceived(const uint32_t startTimestamp)
+		{
+			Driver->OnPacketReceived(startTimestamp);
+		}
+
+		void OnPacketLost(const uint32_t startTimestamp)
+		{
+			Driver->OnPacketLost(startTimestamp);
+		}
+
+#if defined(PIM_CSMA)
+		void OnCollision(const uint32_t timestamp)
+		{
+			Driver->OnCollision(timestamp);
+		}
+#endif
 	};
 
-	PacketReader Reader;
-	PacketWriter Writer;
+	class WriterHandler : public PacketWriterHandler
+	{
+	private:
+		PulsePacketTaskDriver* Driver;
+
+	public:
+		WriterHandler(PulsePacketTaskDriver* driver) : Driver(driver) {}
+
+		void OnPacketSent()
+		{
+			Driver->OnPacketSent();
+		}
+	};
 
-	InterruptFlagsType InterruptFlags;
+	TemplatePacketReader<ReaderHandler> Reader;
+	TemplatePacketWriter<WriterHandler> Writer;
+
+	EventQueueType Events;
+
+#if defined(PIM_SEND_QUEUE)
+	PulseSendQueue<MaxPacketSize, Constants::SendQueueSize> SendQueue;
+	PulseSendStats SendStats;
+
+	// The selected packet is on the line.
+	volatile bool QueueSending = false;
+#endif
+
+#if defined(PIM_SEND_SCHEDULER)
+	uint32_t SendStart = 0;
+#endif
+
+#if defined(PIM_CSMA)
+	uint32_t BackoffStart = 0;
+	uint32_t BackoffInterval = 0;
+	uint32_t RandomState = 0x2545F491;
+	uint8_t BackoffExponent = 0;
+	uint8_t SendAttempts = 0;
+
+	// Backoff has been drawn for the selected packet.
+	bool HeadScheduled = false;
+
+	// Line was busy at the end of the backoff, waiting for silence.
+	bool LineBusy = false;
+#endif
+
+#if defined(PIM_SILENCE_TIMEOUT)
+	// Idle poll for truncated packets, in scheduler time: micros with _TASK_MICRO_RES, millis otherwise.
+#if defined(_TASK_MICRO_RES)
+	static const uint32_t TimeoutPollInterval = Constants::SilenceTimeoutInterval;
+#else
+	static const uint32_t TimeoutPollInterval = 1;
+#endif
+#endif
 
 protected:
-	volatile uint32_t IncomingStartTimestamp = 0;
 	volatile uint32_t LastWriterTimestamp = 0;
 	uint8_t IncomingPacket[MaxPacketSize];
 	uint8_t OutgoingPacket[MaxPacketSize];
 
 protected:
 	// Virtual calls to be overriden.
-	virtual void OnDriverPacketReceived(const uint32_t startTimestamp, const uint8_t packetSize) {}
+	virtual void OnDriverPacketReceived(const uint32_t startTimestamp, const PacketSizeType packetSize) {}
 
 	virtual void OnDriverPacketLost(const uint32_t startTimestamp) {}
 
 	virtual void OnDriverPacketSent() {}
 
+#if defined(PIM_SEND_QUEUE)
+	// A queued packet was given up, after MaxSendAttempts or past its deadline.
+	virtual void OnDriverPacketDropped() {}
+#endif
+
+	// Nothing left to do, the task sleeps until the next event.
 	virtual const bool OnDriverService()
 	{
 		Task::disable();
@@ -53,70 +159,186 @@ protected:
 	}
 
 public:
-#if defined(ARDUINO_ARCH_AVR)
+#if defined(ARDUINO_ARCH_AVR) || defined(PIM_HOST)
 	PulsePacketTaskDriver(Scheduler* scheduler, const uint8_t readPin, const uint8_t writePin)
 #elif defined(ARDUINO_ARCH_STM32F1)
 	PulsePacketTaskDriver(Scheduler* scheduler, const uint8_t readPin, const uint8_t writePin, const uint8_t timerIndex, const uint8_t timerChannel)
 #endif
-		: PacketReaderCallback()
-		, PacketWriterCallback()
-		, Task(0, TASK_FOREVER, scheduler, false)
-		, Reader(IncomingPacket, MaxPacketSize, readPin)
-#if defined(ARDUINO_ARCH_AVR)
-		, Writer(MaxPacketSize, writePin)
+		: Task(0, TASK_FOREVER, scheduler, false)
+		, Reader(ReaderHandler(this), IncomingPacket, MaxPacketSize, readPin)
+#if defined(ARDUINO_ARCH_AVR) || defined(PIM_HOST)
+		, Writer(WriterHandler(this), MaxPacketSize, writePin)
 #elif defined(ARDUINO_ARCH_STM32F1)
-		, Writer(MaxPacketSize, writePin, timerIndex, timerChannel)
+		, Writer(WriterHandler(this), MaxPacketSize, writePin, timerIndex, timerChannel)
 #endif
-		, InterruptFlags()
+		, Events()
 	{}
 
 	bool Callback()
 	{
-		if (InterruptFlags.PacketLost)
-		{
-			InterruptFlags.PacketLost = false;
-			OnDriverPacketLost(IncomingStartTimestamp);
-		}
-		else if (InterruptFlags.PacketReceived)
-		{
-			InterruptFlags.PacketReceived = false;
+#if defined(PIM_SILENCE_TIMEOUT)
+		// Raises PacketLost right away if the incoming packet was truncated.
+		Reader.CheckTimeout();
+#endif
 
-			uint8_t incomingSize = 0;
+		typename EventQueueType::EventStruct event;
+		PacketSizeType incomingSize = 0;
+		bool serviced = false;
 
-			if (Reader.HasIncoming(incomingSize))
+		// Drain all pending events in one pass.
+		while (Events.Pop(event))
+		{
+			serviced = true;
+			switch (event.Type)
 			{
-				OnDriverPacketReceived(IncomingStartTimestamp, incomingSize);
-			}
+			case EventQueueType::PacketLost:
+				OnDriverPacketLost(event.Timestamp);
+				break;
+			case EventQueueType::PacketReceived:
+				// A send since may have blanked and resumed the Reader, dropping the packet.
+				if (Reader.HasIncoming(incomingSize))
+				{
+					OnDriverPacketReceived(event.Timestamp, incomingSize);
 
-			// Restore Reader after consuming the packet.
-			Reader.Restore();
+					// Free the Reader after consuming the packet, it stays blanked if the handler sent a reply.
+					Reader.ClearPending();
+				}
+				break;
+			case EventQueueType::PacketSent:
+#if defined(PIM_SEND_QUEUE)
+				if (QueueSending)
+				{
+					OnQueuedPacketSent();
+				}
+#endif
+				OnDriverPacketSent();
+				break;
+#if defined(PIM_CSMA)
+			case EventQueueType::PacketCollision:
+				QueueSending = false;
+				SendStats.Collisions++;
+				Backoff();
+				break;
+#endif
+			default:
+				break;
+			}
 		}
-		else if (InterruptFlags.PacketSent)
+
+#if defined(PIM_SEND_QUEUE)
+		// Keeps the task enabled while packets are queued.
+		if (ServiceSendQueue())
 		{
-			InterruptFlags.PacketSent = false;
-			LastWriterTimestamp = micros();
-			OnDriverPacketSent();
+			serviced = true;
 		}
-		else
+#endif
+
+		if (!serviced)
 		{
-			return OnDriverService();
+			const bool result = OnDriverService();
+#if defined(PIM_SILENCE_TIMEOUT)
+			if (!Task::isEnabled())
+			{
+				// Idle, keep polling for truncated packets, whatever the hook did.
+				Task::enableDelayed(TimeoutPollInterval);
+			}
+#endif
+			return result;
 		}
 
 		return true;
 	}
 
+#if defined(PIM_ADDRESS_FILTER)
+	// Packets are accepted when (firstByte & mask) == (address & mask).
+	void SetAddressFilter(const uint8_t address, const uint8_t mask)
+	{
+		Reader.SetAddressFilter(address, mask);
+	}
+
+	const uint16_t GetFilteredCount()
+	{
+		return Reader.GetFilteredCount();
+	}
+#endif
+
+#if defined(PIM_RATE_SWITCHING)
+	// Payload rate for the next packets, the receivers must support the fast profile.
+	void SetFastRate(const bool fastRate)
+	{
+		Writer.SetFastRate(fastRate);
+	}
+#endif
+
+#if defined(PIM_TRACE)
+	// Freezes both trace rings and prints them, reader lines start with R, writer lines with W.
+	// Convert with extras/TraceToVcd.
+	template<typename StreamType>
+	void DumpTrace(StreamType& stream)
+	{
+		Reader.FreezeTrace();
+		Writer.FreezeTrace();
+		Reader.GetTrace().Dump(stream, 'R');
+		Writer.GetTrace().Dump(stream, 'W');
+	}
+
+	// Clears both trace rings and starts recording again.
+	void ResumeTrace()
+	{
+		Reader.ResumeTrace();
+		Writer.ResumeTrace();
+	}
+#endif
+
+#if defined(PIM_TIME_SYNC)
+	// Start pulse of the last packet sent, for PulseTimeSync::OnBeaconSent().
+	const uint32_t GetLastSendTimestamp()
+	{
+		return Writer.GetStartTimestamp();
+	}
+#endif
+
+#if defined(PIM_HOST)
+	// Host tools drive the reader and the mock timer directly.
+	TemplatePacketReader<ReaderHandler>& GetReader()
+	{
+		return Reader;
+	}
+
+	TemplatePacketWriter<WriterHandler>& GetWriter()
+	{
+		return Writer;
+	}
+#endif
+
+	// Events lost to a full queue.
+	const uint8_t GetDroppedEventCount()
+	{
+		return Events.GetDroppedCount();
+	}
+
 	// Must perform interrupt attach before starting.
 	// attachInterrupt(digitalPinToInterrupt(ReadPin), OnPulse, RISING);
 	void Start()
 	{
-		Reader.Start(this);
-		Writer.Start(this);
+		Reader.Start();
+		Writer.Start();
+#if defined(PIM_SILENCE_TIMEOUT)
+		// Polls for truncated packets from the start, not only after the first event.
+		Task::enableDelayed(TimeoutPollInterval);
+#endif
 	}
 
 	void Stop()
 	{
 		Reader.Stop();
 		Writer.Stop();
+#if defined(PIM_SEND_QUEUE)
+		QueueSending = false;
+#endif
+#if defined(PIM_CSMA)
+		HeadScheduled = false;
+#endif
 	}
 
 	// Returns false if in the middle of receiving or sending a packet.
@@ -130,13 +352,13 @@ public:
 	}
 
 	// Must check with CanSend() right before this call.
-	void SendPacket(uint8_t* packetData, const uint8_t packetSize)
+	void SendPacket(uint8_t* packetData, const PacketSizeType packetSize)
 	{
 		// Blank reader to ignore cross-talk.
 		Reader.BlankReceive();
 
 		// Copy to out buffer.
-		for (uint8_t i = 0; i < packetSize; i++)
+		for (PacketSizeType i = 0; i < packetSize; i++)
 		{
 			OutgoingPacket[i] = packetData[i];
 		}
@@ -145,33 +367,285 @@ public:
 		Writer.SendPacket(OutgoingPacket, packetSize);
 	}
 
-	virtual void OnPacketReceived(const uint32_t startTimestamp)
+	// Must check with CanSend() right before this call.
+	// Sends the segments as one packet without copying,
+	// their data must stay unchanged until OnDriverPacketSent().
+	void SendPacket(const PacketSegment* segments, const uint8_t segmentCount)
 	{
-		// Flag event and wake up task.
-		InterruptFlags.PacketReceived = true;
-		IncomingStartTimestamp = startTimestamp;
+		// Blank reader to ignore cross-talk.
+		Reader.BlankReceive();
+
+		// Start sending in the background.
+		Writer.SendPacket(segments, segmentCount);
+	}
+
+#if defined(PIM_SEND_QUEUE)
+	// Copies the packet to the send queue, no need to check CanSend().
+	// With PIM_CSMA, each packet waits a random backoff, then is sent if the line is silent.
+	// A busy line or a collision widens the backoff window and tries again.
+	// Returns false if the queue is full.
+#if defined(PIM_SEND_SCHEDULER)
+	// Priority 0 is the most urgent class. The deadline is in micro-seconds from now, 0 for none,
+	// a packet not started by then is dropped.
+	const bool QueuePacket(const uint8_t* packetData, const PacketSizeType packetSize,
+		const uint8_t priority = Constants::SendPriorityClasses - 1, const uint32_t deadline = 0)
+#else
+	const bool QueuePacket(const uint8_t* packetData, const PacketSizeType packetSize)
+#endif
+	{
+#if defined(PIM_SEND_SCHEDULER)
+		if (!SendQueue.Push(packetData, packetSize, priority, deadline, micros()))
+#else
+		if (!SendQueue.Push(packetData, packetSize))
+#endif
+		{
+			return false;
+		}
 
 		Task::enable();
+
+		return true;
+	}
+
+	const uint8_t GetQueuedCount()
+	{
+		return SendQueue.GetCount();
+	}
+
+	void GetSendStats(PulseSendStats& stats)
+	{
+		stats = SendStats;
 	}
 
-	virtual void OnPacketLost(const uint32_t startTimestamp)
+	void ClearSendStats()
 	{
-		// Flag event and wake up task.
-		InterruptFlags.PacketLost = true;
-		IncomingStartTimestamp = startTimestamp;
+		SendStats = PulseSendStats();
+	}
+#endif
+
+#if defined(PIM_CSMA)
+	// Nodes with the same firmware should set a unique seed, such as their address.
+	void SetRandomSeed(const uint32_t seed)
+	{
+		RandomState = (seed != 0) ? seed : 1;
+	}
+#endif
+
+private:
+#if defined(PIM_SEND_QUEUE)
+	// Returns true while packets are queued.
+	const bool ServiceSendQueue()
+	{
+#if defined(PIM_SEND_SCHEDULER)
+		DropExpired();
+#endif
+
+		if (SendQueue.IsEmpty())
+		{
+			return false;
+		}
+
+		if (QueueSending)
+		{
+			// Wait for the sent or collision event.
+			return true;
+		}
+
+#if defined(PIM_CSMA)
+		if (!HeadScheduled)
+		{
+			// Fresh packet, start from the narrowest window.
+			HeadScheduled = true;
+			LineBusy = false;
+			SendAttempts = 0;
+			BackoffExponent = Constants::MinBackoffExponent;
+			SendQueue.Select();
+			ScheduleBackoff();
+		}
+
+		if (micros() - BackoffStart < BackoffInterval)
+		{
+			return true;
+		}
+#endif
+
+		if (CanSend())
+		{
+#if defined(PIM_CSMA)
+			if (LineBusy)
+			{
+				// Silence is back, spread out from here with the other nodes that waited.
+				LineBusy = false;
+				WidenBackoff();
+				return true;
+			}
+#endif
+#if defined(PIM_SEND_SCHEDULER)
+			// A more urgent packet may have been queued since.
+			if (SendQueue.Select())
+			{
+#if defined(PIM_CSMA)
+				SendAttempts = 0;
+#endif
+			}
+			SendStart = micros();
+#endif
+			QueueSending = true;
+
+#if defined(PIM_CSMA)
+			// Read back the line while sending, instead of blanking.
+			Reader.Monitor();
+#else
+			Reader.BlankReceive();
+#endif
+			Writer.SendPacket(SendQueue.PeekData(), SendQueue.PeekSize());
+		}
+#if defined(PIM_CSMA)
+		else if (!LineBusy)
+		{
+			// Not an attempt, the packet waits out the other one however long it is.
+			LineBusy = true;
+			SendStats.Deferrals++;
+		}
+#endif
+
+		return true;
+	}
+
+#if defined(PIM_SEND_SCHEDULER)
+	void DropExpired()
+	{
+		uint8_t priority = 0;
+		while (SendQueue.PopExpired(micros(), QueueSending, priority))
+		{
+			SendStats.Classes[priority].Expired++;
+#if defined(PIM_CSMA)
+			// May have been the selected packet, draw a fresh backoff.
+			HeadScheduled = false;
+#endif
+			OnDriverPacketDropped();
+		}
+	}
+#endif
+
+	void OnQueuedPacketSent()
+	{
+		QueueSending = false;
+		SendStats.Sent++;
+		SendStats.SentBytes += SendQueue.PeekSize();
+#if defined(PIM_SEND_SCHEDULER)
+		PulseSendClassStats& classStats = SendStats.Classes[SendQueue.PeekPriority()];
+		const uint32_t latency = SendStart - SendQueue.PeekQueuedAt();
+		classStats.Sent++;
+		classStats.TotalLatency += latency;
+		if (latency > classStats.MaxLatency)
+		{
+			classStats.MaxLatency = latency;
+		}
+#endif
+		SendQueue.Pop();
+#if defined(PIM_CSMA)
+		HeadScheduled = false;
+#endif
+	}
+#endif
+
+#if defined(PIM_CSMA)
+	// Collision, try again later or give up.
+	void Backoff()
+	{
+		SendAttempts++;
+		if (SendAttempts >= Constants::MaxSendAttempts)
+		{
+			SendQueue.Pop();
+			HeadScheduled = false;
+			SendStats.Dropped++;
+			OnDriverPacketDropped();
+			return;
+		}
+
+		WidenBackoff();
+	}
+
+	void WidenBackoff()
+	{
+		if (BackoffExponent < Constants::MaxBackoffExponent)
+		{
+			BackoffExponent++;
+		}
+		ScheduleBackoff();
+	}
+
+	void ScheduleBackoff()
+	{
+		BackoffStart = micros();
+
+		// Xorshift, with the time mixed in so nodes woken together drift apart.
+		RandomState += BackoffStart;
+		if (RandomState == 0)
+		{
+			RandomState = 1;
+		}
+		RandomState ^= RandomState << 13;
+		RandomState ^= RandomState >> 17;
+		RandomState ^= RandomState << 5;
+
+		BackoffInterval = (RandomState & ((1UL << BackoffExponent) - 1)) * Constants::BackoffSlotInterval;
+	}
+#endif
+
+private:
+	// Interrupt handlers.
+	void OnPacketReceived(const uint32_t startTimestamp)
+	{
+		PacketSizeType incomingSize = 0;
+		Reader.HasIncoming(incomingSize);
+
+		// Queue event and wake up task.
+		if (!Events.Push(EventQueueType::PacketReceived, startTimestamp, incomingSize))
+		{
+			// No room for the event, free the Reader instead of holding the packet forever.
+			Reader.Restore();
+		}
+
+		Task::enable();
+	}
+
+	void OnPacketLost(const uint32_t startTimestamp)
+	{
+		// Queue event and wake up task.
+		Events.Push(EventQueueType::PacketLost, startTimestamp, 0);
 
 		Task::enable();
 	}
 
-	virtual void OnPacketSent()
+	void OnPacketSent()
 	{
+		LastWriterTimestamp = micros();
+
 		// Restore Reader after blanking during sending.
 		Reader.Restore();
 
-		// Flag event and wake up task.
-		InterruptFlags.PacketSent = true;
+		// Queue event and wake up task.
+		Events.Push(EventQueueType::PacketSent, LastWriterTimestamp, 0);
 
 		Task::enable();
 	}
+
+#if defined(PIM_CSMA)
+	void OnCollision(const uint32_t timestamp)
+	{
+		// Abort, the receivers see the packet truncated.
+		Writer.Stop();
+		LastWriterTimestamp = timestamp;
+
+		// Back to receiving.
+		Reader.Restore();
+
+		Events.Push(EventQueueType::PacketCollision, timestamp, 0);
+
+		Task::enable();
+	}
+#endif
 };
 #endif
\ No newline at end of file
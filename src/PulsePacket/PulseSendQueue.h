@@ -0,0 +1,237 @@
+// PulseSendQueue.h
+// Outgoing packet slots, for the driver's queued sending.
+// Packets are copied in, and sent straight from their slot.
+// Main loop only, the selected slot stays in place while the writer reads it.
+//
+// Select() picks the packet to send, the oldest one.
+// With PIM_SEND_SCHEDULER, the lowest priority class goes first,
+// then the earliest deadline, with packets without a deadline last, then the oldest.
+
+#ifndef _PULSE_SEND_QUEUE_h
+#define _PULSE_SEND_QUEUE_h
+
+#include <stdint.h>
+#include <PulseIntervalModulator/Constants.h>
+
+template<const PacketSizeType MaxPacketSize, const uint8_t QueueSize>
+class PulseSendQueue
+{
+private:
+	static_assert(QueueSize > 0 && QueueSize < 128, "QueueSize must be 1 to 127.");
+
+	struct SlotStruct
+	{
+		uint8_t Data[MaxPacketSize];
+		PacketSizeType Size;
+
+		// Push order, wraps.
+		uint8_t Order;
+		bool Used;
+
+#if defined(PIM_SEND_SCHEDULER)
+		uint8_t Priority;
+		uint32_t QueuedAt;
+
+		// Since QueuedAt, 0 for none.
+		uint32_t Deadline;
+#endif
+	};
+
+	SlotStruct Slots[QueueSize];
+
+	// Selected slot.
+	uint8_t Head = 0;
+	uint8_t Count = 0;
+	uint8_t NextOrder = 0;
+
+public:
+	PulseSendQueue()
+	{
+		for (uint8_t i = 0; i < QueueSize; i++)
+		{
+			Slots[i].Used = false;
+		}
+	}
+
+	// Returns false if the queue is full or the packet doesn't fit.
+	const bool Push(const uint8_t* packetData, const PacketSizeType packetSize)
+	{
+		return Allocate(packetData, packetSize) != nullptr;
+	}
+
+#if defined(PIM_SEND_SCHEDULER)
+	// Also returns false for a priority out of range.
+	const bool Push(const uint8_t* packetData, const PacketSizeType packetSize,
+		const uint8_t priority, const uint32_t deadline, const uint32_t now)
+	{
+		if (priority >= Constants::SendPriorityClasses)
+		{
+			return false;
+		}
+
+		SlotStruct* slot = Allocate(packetData, packetSize);
+		if (slot == nullptr)
+		{
+			return false;
+		}
+
+		slot->Priority = priority;
+		slot->QueuedAt = now;
+		slot->Deadline = deadline;
+
+		return true;
+	}
+
+	// Removes one packet past its deadline, except the selected one if keepHead.
+	// Returns false if there was none.
+	const bool PopExpired(const uint32_t now, const bool keepHead, uint8_t& priority)
+	{
+		for (uint8_t i = 0; i < QueueSize; i++)
+		{
+			const SlotStruct& slot = Slots[i];
+			if (slot.Used
+				&& slot.Deadline != 0
+				&& (now - slot.QueuedAt) > slot.Deadline
+				&& !(keepHead && i == Head))
+			{
+				priority = slot.Priority;
+				Remove(i);
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const uint8_t PeekPriority()
+	{
+		return Slots[Head].Priority;
+	}
+
+	const uint32_t PeekQueuedAt()
+	{
+		return Slots[Head].QueuedAt;
+	}
+#endif
+
+	const bool IsEmpty()
+	{
+		return Count == 0;
+	}
+
+	const uint8_t GetCount()
+	{
+		return Count;
+	}
+
+	// Picks the next packet to send, returns true if it changed.
+	const bool Select()
+	{
+		uint8_t best = QueueSize;
+		for (uint8_t i = 0; i < QueueSize; i++)
+		{
+			if (Slots[i].Used
+				&& (best == QueueSize || IsBefore(Slots[i], Slots[best])))
+			{
+				best = i;
+			}
+		}
+
+		if (best == QueueSize || best == Head)
+		{
+			return false;
+		}
+
+		Head = best;
+
+		return true;
+	}
+
+	// Selected packet, valid until Pop().
+	uint8_t* PeekData()
+	{
+		return Slots[Head].Data;
+	}
+
+	const PacketSizeType PeekSize()
+	{
+		return Slots[Head].Size;
+	}
+
+	// Removes the selected packet, Select() the next one.
+	void Pop()
+	{
+		if (Slots[Head].Used)
+		{
+			Remove(Head);
+		}
+	}
+
+private:
+	SlotStruct* Allocate(const uint8_t* packetData, const PacketSizeType packetSize)
+	{
+		if (Count >= QueueSize
+			|| packetSize > MaxPacketSize
+			|| packetSize < Constants::MinDataBytes)
+		{
+			return nullptr;
+		}
+
+		uint8_t index = 0;
+		while (Slots[index].Used)
+		{
+			index++;
+		}
+
+		SlotStruct& slot = Slots[index];
+		for (PacketSizeType i = 0; i < packetSize; i++)
+		{
+			slot.Data[i] = packetData[i];
+		}
+		slot.Size = packetSize;
+		slot.Order = NextOrder++;
+		slot.Used = true;
+		Count++;
+
+		if (Count == 1)
+		{
+			Head = index;
+		}
+
+		return &slot;
+	}
+
+	void Remove(const uint8_t index)
+	{
+		Slots[index].Used = false;
+		Count--;
+	}
+
+	static const bool IsBefore(const SlotStruct& a, const SlotStruct& b)
+	{
+#if defined(PIM_SEND_SCHEDULER)
+		if (a.Priority != b.Priority)
+		{
+			return a.Priority < b.Priority;
+		}
+
+		if (a.Deadline != 0 && b.Deadline != 0)
+		{
+			const int32_t difference = (int32_t)((a.QueuedAt + a.Deadline) - (b.QueuedAt + b.Deadline));
+			if (difference != 0)
+			{
+				return difference < 0;
+			}
+		}
+		else if (a.Deadline != b.Deadline)
+		{
+			// Only one has a deadline.
+			return a.Deadline != 0;
+		}
+#endif
+		// Order wraps, holds for packets queued within 127 pushes.
+		return (int8_t)(a.Order - b.Order) < 0;
+	}
+};
+#endif
\ No newline at end of file
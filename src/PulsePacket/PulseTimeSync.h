@@ -0,0 +1,192 @@
+// PulseTimeSync.h
+// Network time from occasional beacons, timed on the packet start pulse at both ends.
+// The master's clock is network time: its writer timestamps each beacon's start pulse,
+// and the next beacon carries that timestamp, so no follow-up packet is needed.
+// Receivers pair it with their PacketStartTimestamp of the previous beacon,
+// less the fixed link latency (PIM_TIME_SYNC_LATENCY), and track offset and drift.
+//
+// Integer filters only: drift is in 1/2^24 units (0.06 ppm), smoothed by 1/2^DriftFilterShift,
+// offset corrections are smoothed by 1/2^OffsetFilterShift.
+// A jump over MaxStepMicros restarts synchronization, such as after a master reset.
+//
+// Master, needs PIM_TIME_SYNC for the driver's GetLastSendTimestamp():
+//	TimeSync.WriteBeacon(&packet[1]);
+//	Driver.SendPacket(packet, 1 + PulseTimeSync<>::BeaconSize);
+//	... once sent, TimeSync.OnBeaconSent(Driver.GetLastSendTimestamp());
+// Receivers:
+//	TimeSync.OnBeaconReceived(&packet[1], startTimestamp);
+//	TimeSync.GetNetworkMicros();
+
+#ifndef _PULSE_TIME_SYNC_h
+#define _PULSE_TIME_SYNC_h
+
+#include <PulseIntervalModulator/Constants.h>
+#include <Arduino.h>
+
+template<const uint8_t OffsetFilterShift = 1, const uint8_t DriftFilterShift = 2>
+class PulseTimeSync
+{
+public:
+	// Sequence, then the previous beacon's start timestamp, LSB first.
+	static const uint8_t BeaconSize = 5;
+
+	static const uint32_t MaxStepMicros = 1000;
+
+	static const uint8_t DriftShift = 24;
+
+private:
+	// Master.
+	uint32_t SentStart = 0;
+	uint8_t Sequence = 0;
+
+	// Receiver, last beacon.
+	uint32_t ReceivedStart = 0;
+	uint8_t ReceivedSequence = 0;
+	bool HasReceived = false;
+
+	// Last raw sample, for the drift.
+	uint32_t SampleLocal = 0;
+	uint32_t SampleRemote = 0;
+
+	// Local reference and its network time.
+	uint32_t ReferenceLocal = 0;
+	uint32_t ReferenceRemote = 0;
+
+	// Network clock rate minus local clock rate.
+	int32_t Drift = 0;
+
+	uint8_t SampleCount = 0;
+
+public:
+	// Master side.
+	void WriteBeacon(uint8_t* payload)
+	{
+		payload[0] = Sequence;
+		payload[1] = SentStart;
+		payload[2] = SentStart >> 8;
+		payload[3] = SentStart >> 16;
+		payload[4] = SentStart >> 24;
+	}
+
+	// Start pulse of the beacon just sent, carried by the next one.
+	void OnBeaconSent(const uint32_t startTimestamp)
+	{
+		SentStart = startTimestamp;
+		Sequence++;
+	}
+
+	// Receiver side.
+	void OnBeaconReceived(const uint8_t* payload, const uint32_t startTimestamp)
+	{
+		const uint8_t sequence = payload[0];
+
+		// This beacon carries the previous one's send time.
+		if (HasReceived
+			&& (uint8_t)(sequence - 1) == ReceivedSequence)
+		{
+			const uint32_t previousStart = (uint32_t)payload[1]
+				| ((uint32_t)payload[2] << 8)
+				| ((uint32_t)payload[3] << 16)
+				| ((uint32_t)payload[4] << 24);
+
+			AddSample(ReceivedStart, previousStart);
+		}
+
+		ReceivedSequence = sequence;
+		ReceivedStart = startTimestamp - Constants::TimeSyncLatency;
+		HasReceived = true;
+	}
+
+	// Offset and drift are known, after two beacon pairs.
+	const bool IsSynced() const
+	{
+		return SampleCount > 1;
+	}
+
+	void Reset()
+	{
+		HasReceived = false;
+		SampleCount = 0;
+		Drift = 0;
+	}
+
+	// Network time, the synchronized micros().
+	const uint32_t GetNetworkMicros() const
+	{
+		return ToNetworkMicros(micros());
+	}
+
+	const uint32_t ToNetworkMicros(const uint32_t localMicros) const
+	{
+		const int32_t elapsed = (int32_t)(localMicros - ReferenceLocal);
+
+		return ReferenceRemote + elapsed + (int32_t)(((int64_t)elapsed * Drift) >> DriftShift);
+	}
+
+	// Local time of a network time, to schedule aligned work.
+	const uint32_t ToLocalMicros(const uint32_t networkMicros) const
+	{
+		const int32_t elapsed = (int32_t)(networkMicros - ReferenceRemote);
+
+		return ReferenceLocal + elapsed - (int32_t)(((int64_t)elapsed * Drift) >> DriftShift);
+	}
+
+	// Network clock rate minus local clock rate, in 1/2^24 units.
+	const int32_t GetDrift() const
+	{
+		return Drift;
+	}
+
+private:
+	void AddSample(const uint32_t local, const uint32_t remote)
+	{
+		if (SampleCount > 0)
+		{
+			const int32_t error = (int32_t)(remote - ToNetworkMicros(local));
+			const int32_t localDelta = (int32_t)(local - SampleLocal);
+
+			// Without a drift estimate yet, the error is mostly drift.
+			if (localDelta <= 0
+				|| (SampleCount > 1
+					&& (error > (int32_t)MaxStepMicros || error < -(int32_t)MaxStepMicros)))
+			{
+				// Lost track, start over from this sample.
+				SampleCount = 0;
+			}
+			else
+			{
+				const int32_t remoteDelta = (int32_t)(remote - SampleRemote);
+				const int32_t drift = (int32_t)((((int64_t)remoteDelta - localDelta) << DriftShift) / localDelta);
+
+				if (SampleCount == 1)
+				{
+					// First estimate, take it whole.
+					Drift = drift;
+					ReferenceRemote = remote;
+				}
+				else
+				{
+					// From the prediction the error was measured against, before the drift changes.
+					ReferenceRemote = remote - error + (error >> OffsetFilterShift);
+					Drift += (drift - Drift) >> DriftFilterShift;
+				}
+				ReferenceLocal = local;
+			}
+		}
+
+		if (SampleCount == 0)
+		{
+			Drift = 0;
+			ReferenceLocal = local;
+			ReferenceRemote = remote;
+		}
+
+		SampleLocal = local;
+		SampleRemote = remote;
+		if (SampleCount < UINT8_MAX)
+		{
+			SampleCount++;
+		}
+	}
+};
+#endif
\ No newline at end of file
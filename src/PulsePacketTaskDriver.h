@@ -4,6 +4,6 @@
 #ifndef _PULSE_PACKET_h
 #define _PULSE_PACKET_h
 
-#include "PulsePacket\PulsePacketTaskDriver.h"
+#include "PulsePacket/PulsePacketTaskDriver.h"
 
 #endif
\ No newline at end of file